@@ -0,0 +1,31 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "lookup_table.h"
+#include "model.h"
+
+/* Default parameters of the bench command */
+#define BENCH_DEPTH 4
+#define BENCH_THREADS 1
+#define BENCH_HASH_MB 16
+
+/* Positions searched by the bench, also the corpus of the microbenchmarks */
+extern const char *bench_positions[];
+extern const int bench_position_count;
+
+/**
+ * Searches a fixed list of positions to a fixed depth and prints the total
+ * nodes, time and nodes/sec. With a single thread the node count is
+ * deterministic, so it is a signature of the search: a change that must
+ * not alter the search has to keep it
+ *
+ * @param LookupTable * initialized lookup table
+ * @param ChessNN & network evaluating the leaves
+ * @param int depth searched in every position
+ * @param int number of search threads
+ * @param int size in MB of the transposition table
+ */
+void bench(LookupTable *lut, ChessNN &nn, int depth, int threads,
+           int hash_mb);
+
+#endif
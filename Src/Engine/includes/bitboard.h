@@ -1,123 +1,134 @@
 #ifndef CHESS_BOARD_H
 #define CHESS_BOARD_H
 
+#include "bitset64.h"
 #include "lookup_table.h"
 #include "move.h"
+#include "nnue.h"
 #include "utils.h"
 #include <array>
-#include <bitset>
+#include <cstdint>
 #include <vector>
 
+/* Castling rights bits, in the order of the FEN castling field */
+#define WHITE_KING_SIDE 0x1
+#define WHITE_QUEEN_SIDE 0x2
+#define BLACK_KING_SIDE 0x4
+#define BLACK_QUEEN_SIDE 0x8
+#define ALL_CASTLING 0xF
+
 using namespace std;
 
+/*
+ * Irreversible state of a position saved by makeMove so that unmakeMove
+ * can restore it without copying the whole board. The caller keeps it,
+ * usually in the frame that makes the move, so the board holds no history
+ */
+typedef struct {
+  Move move;
+  int8_t capturedPiece;
+  int8_t enPassantSq;
+  uint8_t castlingRights;
+  uint64_t hash;
+} UndoInfo;
+
+static_assert(sizeof(UndoInfo) == 16);
+
 class Bitboard {
 private:
   /* Lookup table */
   LookupTable *lookupTable;
 
   /* Derived squareitions from pieces */
-  bitset<64> allWhitePieces;
-  bitset<64> allBlackPieces;
-  bitset<64> allPieces;
-  bitset<64> emptySquares;
+  Bitset64 allWhitePieces;
+  Bitset64 allBlackPieces;
+  Bitset64 allPieces;
 
   /* Bitboard serialization */
-  bitset<64> piecesBB[12];
-
-  /* Attacking Bitboards */
-  bitset<64> pawnAttacks[2][SQUARES];
-  bitset<64> knightAttacks[SQUARES];
-  bitset<64> kingAttacks[SQUARES];
-  bitset<64> bishopAttacks[SQUARES];
-  bitset<64> rookAttacks[SQUARES];
-
-  /* Move list */
-  /* Per move generation */
-  vector<Move> moveList;
-
-  vector<Move> moveHistory;
+  Bitset64 piecesBB[12];
 
   /* Chess game rules */
   Color turn;
   int enPassantSq;
-  bitset<4> castlingRights;
+  uint8_t castlingRights;
 
-  /* Move generation */
-
-  /* Hyperbolee Quiessence algorithm */
-  bitset<64> generateDiagonalAttacks(int square);
+  /* Zobrist hash of the position, updated incrementally by makeMove */
+  uint64_t hash;
 
-  bitset<64> generateAntiDiagonalAttacks(int square);
+  /* Accumulators of the network updated by the moves, if attached */
+  AccumulatorStack *accumulators;
 
-  bitset<64> generateFileAttacks(int square);
+  /* Check information of the side to move, set by generateMoves */
+  Bitset64 checkers;
+  Bitset64 pinned;
+  Bitset64 checkMask;
 
-  /* First rank attacks algorithm */
-  bitset<64> generateRankAttacks(int square);
+  /* Move generation */
 
   /* Non sliding pieces attack generators */
 
   /**
-   * Generate attacks for king piece type
+   * Generate attacks for king piece type from the shared attack table
    *
    * @param int origin square of the king
    *
-   * @return a bitset<64> containing the target squares
+   * @return a Bitset64 containing the target squares
    * of the possible king attacks
    */
-  bitset<64> generateKingAttacks(int square);
+  Bitset64 generateKingAttacks(int square);
 
   /**
-   * Generate attacks for knight piece type
+   * Generate attacks for knight piece type from the shared attack table
    *
    * @param int origin square of the knight
    *
-   * @return a bitset<64> containing the target squares
+   * @return a Bitset64 containing the target squares
    * of the possible knight attacks
    */
-  bitset<64> generateKnightAttacks(int square);
+  Bitset64 generateKnightAttacks(int square);
 
   /**
-   * Generate attacks for pawn piece type
+   * Generate attacks for pawn piece type from the shared attack table
    *
    * @param Color side of the pawn
    * @param int origin square of the pawn
    *
-   * @return a bitset<64> containing the target squares
+   * @return a Bitset64 containing the target squares
    * of the possible pawn attacks
    */
-  bitset<64> generatePawnAttacks(Color color, int square);
+  Bitset64 generatePawnAttacks(Color color, int square);
 
   /* Sliding pieces attack generators */
 
   /**
-   * Generate attacks for bishop piece type
+   * Generate attacks for bishop piece type with a magic bitboard lookup
    *
    * @param int origin square of the bishop
    *
-   * @return a bitset<64> containing the target squares
+   * @return a Bitset64 containing the target squares
    * of the possible bishop attacks
    */
-  bitset<64> generateBishopAttacks(int square);
+  Bitset64 generateBishopAttacks(int square);
 
   /**
-   * Generate attacks for rook piece type
+   * Generate attacks for rook piece type with a magic bitboard lookup
    *
    * @param int origin square of the rook
    *
-   * @return a bitset<64> containing the target squares
+   * @return a Bitset64 containing the target squares
    * of the possible rook attacks
    */
-  bitset<64> generateRookAttacks(int square);
+  Bitset64 generateRookAttacks(int square);
 
   /**
    * Generate attacks for queen piece type
    *
    * @param int origin square of the queen
    *
-   * @return a bitset<64> containing the target squares
+   * @return a Bitset64 containing the target squares
    * of the possible queen attacks
    */
-  bitset<64> generateQueenAttacks(int square);
+  Bitset64 generateQueenAttacks(int square);
 
   /**
    * Generate moves for pawn piece type
@@ -125,75 +136,85 @@ private:
    * @param Color side of the pawn
    * @param int origin square of the pawn
    *
-   * @return a bitset<64> containing the target squares
+   * @return a Bitset64 containing the target squares
    * of the possible pawn moves
    */
-  bitset<64> generatePawnMoves(Color color, int square);
-
-  /* Attacking bitboards methods */
-
-  /**
-   * Generates all the attacks possible by knights, pawns and kings
-   * in the current position, and saves them in attacking bitboards
-   * members
-   */
-  void nonSlidingAttacks();
-
-  /**
-   * Generates all the attacks possible by bishops and rooks
-   * in the current position, and saves them in attacking bitboards
-   * members
-   *
-   * @note queens can be calculated as bishop + rook so there
-   * is no need to specifically calculate attacks for queens
-   */
-  void slidingAttacks();
+  Bitset64 generatePawnMoves(Color color, int square);
 
   /* Move processing function */
 
   /**
    * Generates all possible moves for a specific piece type
    * by extracting the pieces squares from a bitboard,
-   * generating and categorizing each move and pushing it into moveList
-   * member
+   * generating and categorizing each move and pushing it into a move list
    *
-   * @param bitset<64> bb bitboard containing the pieces
+   * @param MoveList * list where the moves are written
+   * @param Bitset64 bb bitboard containing the pieces
    * @param Color color of the pieces
-   * @param bitset<64> (Bitboard::*attackGenerator)(int) generic function that
+   * @param Bitset64 (Bitboard::*attackGenerator)(int) generic function that
    * generates attacks for the specific piece type given a square
    * @param int piece_type piece type i.e pawn, knight, bishop, rook, queen,
    * king
    */
-  void pieceMoves(bitset<64> bb, Color color,
-                  bitset<64> (Bitboard::*attackGenerator)(int), int piece_type);
+  void pieceMoves(MoveList *moveList, Bitset64 bb, Color color,
+                  Bitset64 (Bitboard::*attackGenerator)(int),
+                  int piece_type);
   /**
    * Generates all possible moves for a specific piece type
    * by extracting the pieces squares from a bitboard,
-   * generating and categorizing each move and pushing it into moveList
-   * member
+   * generating and categorizing each move and pushing it into a move list
    *
-   * @param bitset<64> bb bitboard containing the pieces
+   * @param MoveList * list where the moves are written
+   * @param Bitset64 bb bitboard containing the pieces
    * @param Color color of the pieces
-   * @param bitset<64> (Bitboard::*moveGenerator)(Color, int) generic function
+   * @param Bitset64 (Bitboard::*moveGenerator)(Color, int) generic function
    * that generates all moves for the specific piece type given a square and
    * side
-   * @param bitset<64> (Bitboard::*attackGenerator)(Color, int) generic function
+   * @param Bitset64 (Bitboard::*attackGenerator)(Color, int) generic function
    * that generates attacks for the specific piece type given a square and side
    * @param int piece_type piece type i.e pawn, knight, bishop, rook, queen,
    * king
    */
-  void pieceMoves(bitset<64> bb, Color color,
-                  bitset<64> (Bitboard::*moveGenerator)(Color, int),
-                  bitset<64> (Bitboard::*attackGenerator)(Color, int));
+  void pieceMoves(MoveList *moveList, Bitset64 bb, Color color,
+                  Bitset64 (Bitboard::*moveGenerator)(Color, int),
+                  Bitset64 (Bitboard::*attackGenerator)(Color, int));
+
+  /**
+   * Generates all legal moves for the king of a side, discarding
+   * target squares attacked by the opponent once the king has left its
+   * square
+   *
+   * @param MoveList * list where the moves are written
+   * @param Color side of the king
+   */
+  void kingMoves(MoveList *moveList, Color color);
+
+  /**
+   * Checks if the en passant capture from a square leaves the own king
+   * safe, removing both pawns from their squares
+   *
+   * @param int origin square of the capturing pawn
+   * @param Color side of the capturing pawn
+   * @return true if the en passant capture is legal, false otherwhise
+   */
+  bool isLegalEnPassant(int source_square, Color color);
+
+  /**
+   * Computes the pieces giving check, the pinned pieces
+   * and the mask of the squares that evade a single check for the side
+   * to move
+   */
+  void updateCheckInfo();
 
   /* Castling generation */
 
   /**
    * Generates all the possible castling moves for a side
    *
+   * @param MoveList * list where the moves are written
    * @param Color side to castle
    */
-  void generateCastleMoves(Color side);
+  void generateCastleMoves(MoveList *moveList, Color side);
 
   /* Common chess methods */
 
@@ -201,49 +222,76 @@ private:
    * Gets all the pieces attacking a square
    *
    * @param int square checked
-   * @return a bitset<64> with all the pieces currently attacking the given
+   * @return a Bitset64 with all the pieces currently attacking the given
    * square
    */
-  bitset<64> attacksToSquare(int square);
+  Bitset64 attacksToSquare(int square);
 
   /**
    * Gets all the side pieces attacking a square
    *
    * @param int square checked
    * @param Color side that attacks the square
-   * @return a bitset<64> with all the side pieces currently attacking the given
+   * @return a Bitset64 with all the side pieces currently attacking the given
    * square
    */
-  bitset<64> attacksToSquare(int square, Color side);
+  Bitset64 attacksToSquare(int square, Color side);
 
   /**
-   * Checks if a square is attacked by the given side
+   * Checks if a square is attacked by the given side with a custom board
+   * occupancy, computing sliding attacks on demand
    *
    * @param Color side to be checked
    * @param int square to be checked
+   * @param Bitset64 occupancy of the board
    * @return true if the given square is being attacked by the side,
    * false otherwhise
    */
-  bool isSquareAttacked(Color side, int square);
+  bool isSquareAttacked(Color side, int square, Bitset64 occupancy);
 
   /**
-   * TO-DO
+   * Gets the square of the king of the side to move
+   *
+   * @return square of the king
    */
-  int pieceAtSquare(int square);
+  int kingSquare();
+
+  /**
+   * Gets the piece bitboard a pawn is promoted to
+   *
+   * @param int flag of the promotion move
+   * @param Color side of the promoted pawn
+   * @return index of the promoted piece bitboard
+   */
+  int promotedPieceBB(int flag, Color color);
 
   /* Updating methods */
 
+  /**
+   * Computes the Zobrist hash of the position from scratch
+   *
+   * @return 64 bit Zobrist key of the position
+   */
+  uint64_t computeHash();
+
   /**
    * Updates all derived bitboard
    */
   void updateDerivedBitboards();
 
+  /**
+   * Pushes the accumulator of a move made, with the pieces it changes
+   *
+   * @param const UndoInfo & undo record of the move
+   */
+  void pushAccumulator(const UndoInfo &undo);
+
 public:
   /* Initialize a board with chess default starting position */
   Bitboard(LookupTable *lut);
 
   /* Initialize a custom position */
-  Bitboard(LookupTable *lut, bitset<64> pieces[12], bitset<4> cR, int epSq,
+  Bitboard(LookupTable *lut, Bitset64 pieces[12], uint8_t cR, int epSq,
            Color turn_color);
 
   /* Getters and setters */
@@ -256,28 +304,29 @@ public:
   Color getTurn();
 
   /**
-   * Returns a vector containing the moveList member
+   * Returns the Zobrist hash of the current position
    *
-   * @return moveList member as a vector type
+   * @return 64 bit Zobrist key of the position
    */
-  vector<Move> getMoveList();
+  uint64_t getHash();
 
   /**
-   * Returns a vector containing the moveHistory member
-   *
-   * @return moveHistory member as a vector type
+   * TO-DO
    */
-  vector<Move> getMoveHistory();
+  array<int, 64> getPiecesAtSquares();
 
   /**
-   * TO-DO
+   * Gets the piece standing on a square
+   *
+   * @param int square to be checked
+   * @return index of the piece bitboard, or 12 if the square is empty
    */
-  array<int, 64> getPiecesAtSquares();
+  int pieceAtSquare(int square);
 
   /**
    * TO-DO
    */
-  bitset<64> *getPieces();
+  Bitset64 *getPieces();
 
   /**
    * Set the LookupTable struct for the Bitboard object
@@ -286,31 +335,49 @@ public:
    */
   void setLookupTable(LookupTable *lut);
 
+  /**
+   * Attaches a stack of accumulators that the moves push and pop, or
+   * detaches it with nullptr. The position becomes the root of the stack
+   *
+   * @param AccumulatorStack * stack of accumulators, its root is computed
+   * by the caller
+   */
+  void setAccumulators(AccumulatorStack *stack);
+
+  /**
+   * Returns the attached stack of accumulators
+   *
+   * @return stack of accumulators, or nullptr if none is attached
+   */
+  AccumulatorStack *getAccumulators();
+
   /* Move methods */
 
-  // SHOULD MAKE THIS PRIVATE
   /**
-   * Generate pseudo-legal moves for the current position
-   * and saves it to moveList member
+   * Generate legal moves for the current position
+   *
+   * @param MoveList * list where the moves are written, it is cleared
+   * first
    */
-  void generateMoves();
+  void generateMoves(MoveList *moveList);
 
   /**
-   * Makes a move in the position
+   * Makes a move in the position, saving an undo record so it can
+   * be taken back with unmakeMove
    *
    * @param a Move type object representing the move to be
-   * made
-   * @return true if the move is valid, false otherwhise
+   * made, it must be one of the legal moves generated for the position
+   * @param UndoInfo * where the undo record of the move is written
    */
-  bool makeMove(Move move);
+  void makeMove(Move move, UndoInfo *undo);
 
   /**
-   * unmakes the previous move of the position
+   * Unmakes the last move made on the position restoring the state
+   * saved in its undo record
    *
-   * @param a Move type object representing the previous move to be
-   * unmade
+   * @param const UndoInfo & undo record written when the move was made
    */
-  void unmakeMove();
+  void unmakeMove(const UndoInfo &undo);
 
   /* Checks, checkmates, stalemates */
 
@@ -324,9 +391,19 @@ public:
   bool isCheck(Color side);
 
   /**
-   * Checks if there is a checkmate for a given side
+   * Checks if a square is attacked by the given side
    *
    * @param Color side to be checked
+   * @param int square to be checked
+   * @return true if the given square is being attacked by the side,
+   * false otherwhise
+   */
+  bool isSquareAttacked(Color side, int square);
+
+  /**
+   * Checks if there is a checkmate for a given side
+   *
+   * @param Color side to be checked, it must be the side to move
    * @return true if there is a checkmate for the given side,
    * false otherwhise
    */
@@ -335,7 +412,7 @@ public:
   /**
    * Checks if there is a stalemate for a given side
    *
-   * @param Color side to be checked
+   * @param Color side to be checked, it must be the side to move
    * @return true if there is a stalemate for the given side,
    * false otherwhise
    */
@@ -358,7 +435,7 @@ public:
    *
    * @param bitboard to be printed
    */
-  void printBitboard(bitset<64> bitboard);
+  void printBitboard(Bitset64 bitboard);
 
   /**
    * Prints the current position with chess format
@@ -382,4 +459,8 @@ public:
   Bitboard copyBoard();
 };
 
+/* A board fits in about three cache lines, so the copies handed to the
+ * search threads and perft workers stay cheap */
+static_assert(sizeof(Bitboard) < 200);
+
 #endif
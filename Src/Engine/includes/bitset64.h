@@ -0,0 +1,117 @@
+#ifndef BITSET64_H
+#define BITSET64_H
+
+#include <bit>
+#include <cstdint>
+
+/*
+ * 64-bit set of squares used for every bitboard of the engine
+ *
+ * It keeps the std::bitset<64> interface the engine was written against,
+ * adding least significant bit helpers, but it is a plain uint64_t so all
+ * operations are constexpr integer ops (popcnt, tzcnt, blsr) with no
+ * conversions in between
+ */
+class Bitset64 {
+private:
+  uint64_t bits;
+
+public:
+  constexpr Bitset64() : bits(0) {}
+
+  constexpr Bitset64(uint64_t b) : bits(b) {}
+
+  constexpr uint64_t to_ullong() const { return bits; }
+
+  /* Single square access */
+
+  constexpr bool test(int square) const { return (bits >> square) & 1; }
+
+  constexpr bool operator[](int square) const { return test(square); }
+
+  constexpr Bitset64 &set(int square, bool value = true) {
+    bits = (bits & ~(1ULL << square)) | ((uint64_t)value << square);
+    return *this;
+  }
+
+  constexpr Bitset64 &reset(int square) {
+    bits &= ~(1ULL << square);
+    return *this;
+  }
+
+  /* Whole set access */
+
+  constexpr Bitset64 &set() {
+    bits = ~0ULL;
+    return *this;
+  }
+
+  constexpr Bitset64 &reset() {
+    bits = 0;
+    return *this;
+  }
+
+  constexpr Bitset64 &flip() {
+    bits = ~bits;
+    return *this;
+  }
+
+  constexpr bool any() const { return bits != 0; }
+
+  constexpr bool none() const { return bits == 0; }
+
+  constexpr int count() const { return std::popcount(bits); }
+
+  /* Least significant bit helpers, undefined on an empty set */
+
+  constexpr int lsb() const { return std::countr_zero(bits); }
+
+  constexpr int popLsb() {
+    int square = lsb();
+    bits &= bits - 1;
+    return square;
+  }
+
+  /* Bitwise operators */
+
+  constexpr Bitset64 operator&(Bitset64 b) const { return bits & b.bits; }
+
+  constexpr Bitset64 operator|(Bitset64 b) const { return bits | b.bits; }
+
+  constexpr Bitset64 operator^(Bitset64 b) const { return bits ^ b.bits; }
+
+  constexpr Bitset64 operator~() const { return ~bits; }
+
+  constexpr Bitset64 operator<<(int shift) const { return bits << shift; }
+
+  constexpr Bitset64 operator>>(int shift) const { return bits >> shift; }
+
+  constexpr Bitset64 &operator&=(Bitset64 b) {
+    bits &= b.bits;
+    return *this;
+  }
+
+  constexpr Bitset64 &operator|=(Bitset64 b) {
+    bits |= b.bits;
+    return *this;
+  }
+
+  constexpr Bitset64 &operator^=(Bitset64 b) {
+    bits ^= b.bits;
+    return *this;
+  }
+
+  constexpr Bitset64 &operator<<=(int shift) {
+    bits <<= shift;
+    return *this;
+  }
+
+  constexpr Bitset64 &operator>>=(int shift) {
+    bits >>= shift;
+    return *this;
+  }
+
+  constexpr bool operator==(const Bitset64 &b) const = default;
+};
+
+#endif
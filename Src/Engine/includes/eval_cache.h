@@ -0,0 +1,85 @@
+#ifndef EVAL_CACHE_H
+#define EVAL_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/* Size of the evaluation cache in MB, 0 disables it */
+#define DEFAULT_EVAL_CACHE_MB 16
+#define MAX_EVAL_CACHE_MB 4096
+
+using namespace std;
+
+/*
+ * Lossy lockless cache of the evaluations of the network, shared by every
+ * search thread, so a position reached again by another move order is not
+ * evaluated twice
+ *
+ * Entry encoding format
+ *
+ * bits  0-15 score (int16_t)
+ * bits 16-63 upper 48 bits of the key
+ *
+ * An entry is a single 64 bit word, so it is never torn by two threads, and
+ * a position simply replaces the one stored in its entry. The entry is
+ * chosen with the lower 32 bits of the key, so most of the bits verified
+ * are not the ones that chose it
+ */
+class EvalCache {
+private:
+  atomic<uint64_t> *entries;
+  size_t entryCount;
+
+  /**
+   * Maps a key to its entry by scaling its lower 32 bits to the number of
+   * entries, which is below 2^32 for any allowed size
+   *
+   * @param uint64_t Zobrist key of the position
+   * @return entry where the position is stored
+   */
+  atomic<uint64_t> &entry(uint64_t key) {
+    return entries[((key & 0xFFFFFFFF) * entryCount) >> 32];
+  }
+
+public:
+  EvalCache(size_t mb);
+
+  ~EvalCache();
+
+  EvalCache(const EvalCache &) = delete;
+
+  EvalCache &operator=(const EvalCache &) = delete;
+
+  /**
+   * Reallocates the cache, discarding every entry. If the allocation fails
+   * bad_alloc is thrown and the current cache is kept untouched
+   *
+   * @param size_t new size in MB, 0 to disable the cache
+   */
+  void resize(size_t mb);
+
+  /**
+   * Clears every entry of the cache
+   */
+  void clear();
+
+  /**
+   * Looks up the evaluation of a position
+   *
+   * @param uint64_t Zobrist key of the position
+   * @param int * where the score is written if found
+   * @return whether the position was found
+   */
+  bool probe(uint64_t key, int *score);
+
+  /**
+   * Stores the evaluation of a position, replacing the one in its entry
+   *
+   * @param uint64_t Zobrist key of the position
+   * @param int score of the position, within int16_t
+   */
+  void store(uint64_t key, int score);
+};
+
+#endif
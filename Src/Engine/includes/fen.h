@@ -0,0 +1,20 @@
+#ifndef FEN_H
+#define FEN_H
+
+#include "bitboard.h"
+#include "lookup_table.h"
+#include <string>
+
+using namespace std;
+
+/**
+ * Builds a position from a FEN string. The halfmove and fullmove counters,
+ * and anything after them, are ignored
+ *
+ * @param LookupTable * initialized lookup table
+ * @param string FEN of the position
+ * @return the position
+ */
+Bitboard parse_fen(LookupTable *lut, string fen_str);
+
+#endif
@@ -1,22 +1,207 @@
 #ifndef LOOKUP_TABLE_H
 #define LOOKUP_TABLE_H
 
+#include "bitset64.h"
 #include "utils.h"
-#include <bitset>
+#include <array>
+#include <cstdint>
+
+#ifdef USE_PEXT
+#include <immintrin.h>
+#endif
+
+/* Masks of every file but the ones non sliding pieces wrap around from */
+#define CLEAR_A_FILE 0xFEFEFEFEFEFEFEFEULL
+#define CLEAR_B_FILE 0xFDFDFDFDFDFDFDFDULL
+#define CLEAR_G_FILE 0xBFBFBFBFBFBFBFBFULL
+#define CLEAR_H_FILE 0x7F7F7F7F7F7F7F7FULL
+
+/* Number of entries of the shared sliding attack tables */
+#define BISHOP_ATTACKS_SIZE 5248
+#define ROOK_ATTACKS_SIZE 102400
 
 using namespace std;
 
+/*
+ * Fancy magic bitboard entry of a sliding piece for a single square
+ *
+ * The relevant occupancy (mask) is hashed into an index of the attacks
+ * subtable of the square, either by a magic multiplication and shift or,
+ * when built with USE_PEXT, by a BMI2 parallel bits extract
+ */
 typedef struct {
-  bitset<64> clear_rank[RANKS];
-  bitset<64> clear_file[FILES];
-  bitset<64> mask_rank[RANKS];
-  bitset<64> mask_file[FILES];
-  bitset<64> mask_diagonal[DIAGONALS + 1];
-  bitset<64> mask_antidiagonal[DIAGONALS + 1];
-  bitset<64> piece_lookup[SQUARES];
-  bitset<64> mask_first_rank_attacks[SQUARES * RANKS];
+  Bitset64 mask;
+  uint64_t magic;
+  Bitset64 *attacks;
+  unsigned int shift;
+} Magic;
+
+typedef struct {
+  Bitset64 clear_rank[RANKS];
+  Bitset64 clear_file[FILES];
+  Bitset64 mask_rank[RANKS];
+  Bitset64 mask_file[FILES];
+  Bitset64 piece_lookup[SQUARES];
+  Bitset64 between[SQUARES][SQUARES];
+  Bitset64 line[SQUARES][SQUARES];
+  Magic bishop_magics[SQUARES];
+  Magic rook_magics[SQUARES];
+  Bitset64 bishop_attacks[BISHOP_ATTACKS_SIZE];
+  Bitset64 rook_attacks[ROOK_ATTACKS_SIZE];
 } LookupTable;
 
 LookupTable *init_lookup_table();
 
+/* Non sliding pieces attack generators */
+
+/**
+ * Generate attacks for king piece type
+ *
+ * @param int origin square of the king
+ * @return a Bitset64 containing the target squares
+ * of the possible king attacks
+ */
+constexpr Bitset64 generate_king_attacks(int square) {
+  Bitset64 king = 1ULL << square;
+
+  Bitset64 a_file_clipping = king & CLEAR_A_FILE;
+  Bitset64 h_file_clipping = king & CLEAR_H_FILE;
+
+  Bitset64 left_move = a_file_clipping >> 1;
+  Bitset64 right_move = h_file_clipping << 1;
+  Bitset64 upward_move = king << 8;
+  Bitset64 downward_move = king >> 8;
+  Bitset64 diagonal_left_up_move = a_file_clipping << 7;
+  Bitset64 diagonal_left_down_move = a_file_clipping >> 9;
+  Bitset64 diagonal_right_up_move = h_file_clipping << 9;
+  Bitset64 diagonal_right_down_move = h_file_clipping >> 7;
+
+  return (left_move | right_move | upward_move | downward_move |
+          diagonal_right_down_move | diagonal_left_down_move |
+          diagonal_left_up_move | diagonal_right_up_move);
+}
+
+/**
+ * Generate attacks for knight piece type
+ *
+ * @param int origin square of the knight
+ * @return a Bitset64 containing the target squares
+ * of the possible knight attacks
+ */
+constexpr Bitset64 generate_knight_attacks(int square) {
+  Bitset64 knight = 1ULL << square;
+
+  Bitset64 a_file_clipping = knight & CLEAR_A_FILE;
+  Bitset64 h_file_clipping = knight & CLEAR_H_FILE;
+  Bitset64 b_file_clipping = knight & CLEAR_B_FILE;
+  Bitset64 g_file_clipping = knight & CLEAR_G_FILE;
+
+  Bitset64 up_left_move = a_file_clipping << 15;
+  Bitset64 up_right_move = h_file_clipping << 17;
+  Bitset64 down_left_move = a_file_clipping >> 17;
+  Bitset64 down_right_move = h_file_clipping >> 15;
+  Bitset64 right_up_move = (h_file_clipping & g_file_clipping) << 10;
+  Bitset64 right_down_move = (h_file_clipping & g_file_clipping) >> 6;
+  Bitset64 left_up_move = (a_file_clipping & b_file_clipping) << 6;
+  Bitset64 left_down_move = (a_file_clipping & b_file_clipping) >> 10;
+
+  return (up_left_move | up_right_move | down_left_move | down_right_move |
+          right_up_move | right_down_move | left_up_move | left_down_move);
+}
+
+/**
+ * Generate attacks for pawn piece type
+ *
+ * @param Color side of the pawn
+ * @param int origin square of the pawn
+ * @return a Bitset64 containing the target squares
+ * of the possible pawn attacks
+ */
+constexpr Bitset64 generate_pawn_attacks(Color color, int square) {
+  Bitset64 pawn = 1ULL << square;
+
+  Bitset64 a_file_clipping = pawn & CLEAR_A_FILE;
+  Bitset64 h_file_clipping = pawn & CLEAR_H_FILE;
+
+  if (color == WHITE) {
+    return a_file_clipping << 7 | h_file_clipping << 9;
+  }
+
+  return a_file_clipping >> 9 | h_file_clipping >> 7;
+}
+
+/* Non sliding pieces attack tables, shared by every position and generated
+ * at compile time */
+
+inline constexpr array<Bitset64, SQUARES> king_attacks = [] {
+  array<Bitset64, SQUARES> table{};
+  for (int square = 0; square < SQUARES; square++) {
+    table[square] = generate_king_attacks(square);
+  }
+  return table;
+}();
+
+inline constexpr array<Bitset64, SQUARES> knight_attacks = [] {
+  array<Bitset64, SQUARES> table{};
+  for (int square = 0; square < SQUARES; square++) {
+    table[square] = generate_knight_attacks(square);
+  }
+  return table;
+}();
+
+inline constexpr array<array<Bitset64, SQUARES>, 2> pawn_attacks = [] {
+  array<array<Bitset64, SQUARES>, 2> table{};
+  for (int square = 0; square < SQUARES; square++) {
+    table[WHITE][square] = generate_pawn_attacks(WHITE, square);
+    table[BLACK][square] = generate_pawn_attacks(BLACK, square);
+  }
+  return table;
+}();
+
+static_assert(knight_attacks[b1] == Bitset64(0x0000000000050800ULL));
+static_assert(king_attacks[h8] == Bitset64(0x40C0000000000000ULL));
+
+/**
+ * Computes the index of an occupancy inside the attacks subtable of a magic
+ *
+ * @param const Magic & magic entry of the square
+ * @param Bitset64 occupancy of the board
+ * @return index of the attack set for the relevant occupancy
+ */
+inline unsigned int magic_index(const Magic &magic, Bitset64 occupancy) {
+#ifdef USE_PEXT
+  return _pext_u64(occupancy.to_ullong(), magic.mask.to_ullong());
+#else
+  return ((occupancy & magic.mask).to_ullong() * magic.magic) >> magic.shift;
+#endif
+}
+
+/**
+ * Looks up the attacks of a bishop given the board occupancy
+ *
+ * @param const LookupTable * initialized lookup table
+ * @param int origin square of the bishop
+ * @param Bitset64 occupancy of the board
+ * @return a Bitset64 containing the attacked squares
+ */
+inline Bitset64 bishop_attacks(const LookupTable *lut, int square,
+                               Bitset64 occupancy) {
+  const Magic &magic = lut->bishop_magics[square];
+  return magic.attacks[magic_index(magic, occupancy)];
+}
+
+/**
+ * Looks up the attacks of a rook given the board occupancy
+ *
+ * @param const LookupTable * initialized lookup table
+ * @param int origin square of the rook
+ * @param Bitset64 occupancy of the board
+ * @return a Bitset64 containing the attacked squares
+ */
+inline Bitset64 rook_attacks(const LookupTable *lut, int square,
+                             Bitset64 occupancy) {
+  const Magic &magic = lut->rook_magics[square];
+  return magic.attacks[magic_index(magic, occupancy)];
+}
+
 #endif
@@ -1,26 +1,302 @@
 #ifndef MODEL_H
 #define MODEL_H
 
-#include <bitset>
+#include "bitboard.h"
+#include "bitset64.h"
+#include "nnue.h"
+#include <cstdint>
+#include <memory>
 #include <onnxruntime/onnxruntime_cxx_api.h>
 #include <string>
 #include <utility>
 #include <vector>
 
+/* Inputs of a perspective: the side to move and the 12 piece planes */
+#define NN_INPUT_SIZE 769
+
+/* Positions evaluated together by a single run of the network */
+#define NN_DEFAULT_BATCH 1
+#define NN_MAX_BATCH 256
+
+/* Threads of ONNX Runtime running a single evaluation, the search threads
+ * run their own evaluations in parallel */
+#define NN_DEFAULT_INTRA_THREADS 1
+#define NN_DEFAULT_INTER_THREADS 1
+
+/* Names of the graph optimization levels of ONNX Runtime, as in the
+ * OnnxOptimization UCI option, and the levels */
+inline const char *onnx_optimization_names[] = {"disable", "basic",
+                                                "extended", "all"};
+inline const GraphOptimizationLevel onnx_optimization_levels[] = {
+    ORT_DISABLE_ALL, ORT_ENABLE_BASIC, ORT_ENABLE_EXTENDED, ORT_ENABLE_ALL};
+
+/* Settings of the ONNX Runtime session. Thread counts of 0 are the ONNX
+ * Runtime defaults, and the optimized model is saved to its path, if any,
+ * and loaded from it in the next runs */
+typedef struct {
+  int intraOpThreads;
+  int interOpThreads;
+  GraphOptimizationLevel optimizationLevel;
+  std::string optimizedModelPath;
+} OnnxConfig;
+
+/**
+ * Returns the default settings of the ONNX Runtime session: a single
+ * thread for every evaluation and every graph optimization
+ *
+ * @return default settings
+ */
+OnnxConfig init_onnx_config();
+
+/* Backends evaluating the positions: the best one available, ONNX Runtime,
+ * and the native evaluator with each instruction set */
+enum EvalBackend {
+  BACKEND_AUTO,
+  BACKEND_ONNX,
+  BACKEND_SCALAR,
+  BACKEND_AVX2,
+  BACKEND_AVX512
+};
+
+/* Names of the backends, as in the EvalBackend UCI option */
+inline const char *eval_backend_names[] = {"auto", "onnx", "scalar", "avx2",
+                                           "avx512"};
+
+/*
+ * Input and output buffers of a thread for a batch size, bound once to the
+ * session so an evaluation only writes the input and runs the network
+ */
+class NNBinding {
+public:
+  int batch;
+  std::vector<float> input;
+  std::vector<float> output;
+  Ort::Value inputTensor;
+  Ort::Value outputTensor;
+  Ort::IoBinding binding;
+
+  NNBinding(Ort::Session &session, const Ort::MemoryInfo &mem_info,
+            const std::string &input_name, const std::string &output_name,
+            const std::vector<int64_t> &output_shape, int batch);
+
+  NNBinding(const NNBinding &) = delete;
+
+  NNBinding &operator=(const NNBinding &) = delete;
+};
+
+/*
+ * Value network of the engine, evaluated by ONNX Runtime or natively. The
+ * native evaluator loads the weights file next to the model, with the
+ * extension .qnnue for the quantized network or .nnue for the float one,
+ * and evaluates the search leaves from the accumulators.
+ * The ONNX Runtime session is only created when that backend is used. It
+ * is shared by every search thread, as its Run is thread safe, and every
+ * thread runs it with its own bound buffers
+ */
 class ChessNN {
 public:
-  ChessNN(const std::string &model_path);
+  /**
+   * Loads the network with the best backend available
+   *
+   * @param const std::string & path of the ONNX model
+   * @param const OnnxConfig & settings of the ONNX Runtime session
+   */
+  ChessNN(const std::string &model_path,
+          const OnnxConfig &config = init_onnx_config());
+
+  /**
+   * Changes the settings of the ONNX Runtime session, creating it again if
+   * it was created. It must not run while the threads evaluate
+   *
+   * @param const OnnxConfig & settings of the session
+   * @return false if the session cannot be created with them, then the
+   * settings are not changed
+   */
+  bool setOnnxConfig(const OnnxConfig &config);
+
+  /**
+   * Returns the settings of the ONNX Runtime session
+   *
+   * @return settings of the session
+   */
+  OnnxConfig getOnnxConfig();
+
+  /**
+   * Sets the backend evaluating the positions. It must not run while the
+   * threads evaluate
+   *
+   * @param EvalBackend backend, BACKEND_AUTO for the native evaluator with
+   * the widest instruction set if its weights are loaded, ONNX Runtime
+   * otherwise
+   * @return false if the backend is not available, then it is not changed
+   */
+  bool setBackend(EvalBackend backend);
+
+  /**
+   * Returns the backend evaluating the positions
+   *
+   * @return backend in use, never BACKEND_AUTO
+   */
+  EvalBackend getBackend();
 
-  std::pair<std::vector<float>, std::vector<float>>
-  board_to_input(const std::bitset<64> *pieces_bb, int turn);
+  /**
+   * Writes the inputs of both perspectives, white first, the black one
+   * with the ranks mirrored
+   *
+   * @param const Bitset64 * piece bitboards of the position
+   * @param int side to move
+   * @param float * buffer of 2 * NN_INPUT_SIZE inputs
+   */
+  void board_to_input(const Bitset64 *pieces_bb, int turn, float *input);
 
-  float predict(const std::bitset<64> *pieces_bb, int turn);
+  /**
+   * Makes room for the buffers of the threads that do not have them yet.
+   * It must not run while the threads evaluate
+   *
+   * @param int number of threads evaluating positions
+   */
+  void setThreads(int threads);
+
+  /**
+   * Sets the most positions evaluated by a single run of the network
+   *
+   * @param int batch size, between 1 and NN_MAX_BATCH, lowered to the
+   * batch of the model if it is fixed
+   */
+  void setBatchSize(int batch);
+
+  /**
+   * Returns the most positions evaluated by a single run of the network
+   *
+   * @return batch size
+   */
+  int getBatchSize();
+
+  /**
+   * Returns whether the backend is the native evaluator
+   *
+   * @return true if the leaves are evaluated from the accumulators
+   */
+  bool isNative();
+
+  /**
+   * Attaches the accumulators of a thread to a board and computes the one
+   * of its position. Nothing is attached unless the backend is native
+   *
+   * @param Bitboard * board searched by the thread
+   * @param int thread searching, below the number given to setThreads
+   */
+  void attach(Bitboard *bb, int thread);
+
+  /**
+   * Evaluates a search leaf, from the accumulators of the board if they
+   * are attached and with ONNX Runtime otherwise
+   *
+   * @param Bitboard * position to evaluate
+   * @param int thread evaluating, below the number given to setThreads
+   * @return evaluation in centipawns from the white point of view
+   */
+  float evaluate(Bitboard *bb, int thread);
+
+  /**
+   * Evaluates a position with the buffers of a thread, from scratch with
+   * the native backend
+   *
+   * @param const Bitset64 * piece bitboards of the position
+   * @param int side to move
+   * @param int thread evaluating, below the number given to setThreads
+   * @return evaluation in centipawns from the white point of view
+   */
+  float predict(const Bitset64 *pieces_bb, int turn, int thread = 0);
+
+  /**
+   * Evaluates several positions with the buffers of a thread, running the
+   * network once for every batch of them, with inputs of shape
+   * {batch, 2, NN_INPUT_SIZE}
+   *
+   * @param const Bitset64 (*)[12] piece bitboards of every position
+   * @param const int * side to move of every position
+   * @param int number of positions
+   * @param float * where the evaluations in centipawns from the white point
+   * of view are written
+   * @param int thread evaluating, below the number given to setThreads
+   */
+  void predict_batch(const Bitset64 (*pieces_bb)[12], const int *turns,
+                     int count, float *evals, int thread = 0);
 
 private:
+  std::string model_path;
+  EvalBackend backend;
+
+  OnnxConfig onnx_config;
   Ort::Env env;
-  Ort::SessionOptions session_options;
-  Ort::Session session;
+  std::unique_ptr<Ort::Session> session;
   Ort::AllocatorWithDefaultOptions allocator;
+  Ort::MemoryInfo mem_info;
+  Ort::RunOptions run_options;
+
+  /* Queried once from the session */
+  std::string input_name;
+  std::string output_name;
+  std::vector<int64_t> output_shape;
+
+  int batch_size;
+  int max_batch;
+  bool fixed_batch;
+
+  NNUE native;
+  bool native_loaded;
+
+  /* Accumulators of every thread, created on first use, and the ones
+   * the positions evaluated from scratch are computed in */
+  std::vector<std::unique_ptr<AccumulatorStack>> accumulators;
+  std::vector<std::unique_ptr<Accumulator>> scratch;
+
+  /**
+   * Creates an ONNX Runtime session with the current settings, from the
+   * optimized model if it was saved
+   *
+   * @return session created
+   */
+  std::unique_ptr<Ort::Session> createSession();
+
+  /**
+   * Replaces the ONNX Runtime session, dropping the buffers bound to the
+   * previous one, and queries the inputs and outputs of the model
+   *
+   * @param std::unique_ptr<Ort::Session> session created
+   */
+  void useSession(std::unique_ptr<Ort::Session> created);
+
+  /**
+   * Creates the ONNX Runtime session, if not created yet
+   */
+  void loadSession();
+
+  /* Buffers of every thread, one per power of two batch size up to the
+   * maximum batch, created on first use */
+  std::vector<std::vector<std::unique_ptr<NNBinding>>> bindings;
+
+  /**
+   * Gets the buffers of a thread that fit a batch, creating them the first
+   * time. Their batch size is rounded up to a power of two, or is the
+   * maximum batch if smaller, so the rows past the batch are padding
+   *
+   * @param int thread evaluating
+   * @param int number of positions of the batch
+   * @return buffers bound to the session
+   */
+  NNBinding &getBinding(int thread, int batch);
+
+  /**
+   * Runs the network on the inputs written in a batch
+   *
+   * @param NNBinding & buffers of the batch
+   * @param int number of positions of the batch, at most the batch size of
+   * the buffers
+   * @param float * where the evaluations in centipawns are written
+   */
+  void run(NNBinding &buffers, int batch, float *evals);
 };
 
 #endif
@@ -1,7 +1,10 @@
 #ifndef MOVE_H
 #define MOVE_H
 
-#include <bitset>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
 
 #define PAWN 0
 #define KNIGHT 1
@@ -28,6 +31,9 @@
 #define PROMOTION 14
 #define PROMOTION_CAPTURE 15
 
+/* Upper bound of the legal moves in any chess position (218) */
+#define MAX_MOVES 256
+
 /*
  * Move encoding format
  *
@@ -42,26 +48,32 @@ using namespace std;
 
 class Move {
 private:
-  bitset<6> sourceSquare;
-  bitset<6> targetSquare;
-  bitset<4> flag;
-  bitset<3> piece;
-  bitset<1> color;
+  uint32_t data = 0;
 
 public:
-  Move();
+  /* A default constructed Move has every bit cleared and is used as the
+   * null move */
+  Move() = default;
+
+  constexpr Move(int source_square, int target_square, int fl, int piece_t,
+                 int clr)
+      : data(source_square | (target_square << 6) | (fl << 12) |
+             (piece_t << 16) | ((clr & 1) << 19)) {}
+
+  /* Builds a move back from its raw encoding */
+  constexpr explicit Move(uint32_t raw) : data(raw) {}
 
-  Move(int source_square, int target_square, int fl, int piece_t, int clr);
+  constexpr uint32_t getData() const { return data; }
 
-  unsigned long getSourceSquare();
+  constexpr int getSourceSquare() const { return data & 0x3F; }
 
-  unsigned long getTargetSquare();
+  constexpr int getTargetSquare() const { return (data >> 6) & 0x3F; }
 
-  unsigned long getFlag();
+  constexpr int getFlag() const { return (data >> 12) & 0xF; }
 
-  unsigned long getPiece();
+  constexpr int getPiece() const { return (data >> 16) & 0x7; }
 
-  unsigned long getColor();
+  constexpr int getColor() const { return (data >> 19) & 0x1; }
 
   string parsePiece();
 
@@ -69,11 +81,69 @@ public:
 
   string formatToAlgebraic();
 
-  bool operator==(const Move &move);
+  string formatToUci();
+
+  constexpr bool operator==(const Move &move) const {
+    return data == move.data;
+  }
 
   void printMove();
 
   void prettyPrintMove();
 };
 
+static_assert(is_trivially_copyable_v<Move> && sizeof(Move) == 4);
+
+/*
+ * Fixed capacity list of moves stored inline, so move generation writes
+ * into a caller supplied buffer without allocating. Every move has a
+ * score alongside used for move ordering
+ */
+class MoveList {
+private:
+  Move moves[MAX_MOVES];
+  int scores[MAX_MOVES];
+  int count;
+
+public:
+  MoveList() : count(0) {}
+
+  void push(Move move) { moves[count++] = move; }
+
+  void clear() { count = 0; }
+
+  int size() const { return count; }
+
+  bool empty() const { return count == 0; }
+
+  Move &operator[](int index) { return moves[index]; }
+
+  int &score(int index) { return scores[index]; }
+
+  Move *begin() { return moves; }
+
+  Move *end() { return moves + count; }
+
+  /**
+   * Selection sort step: swaps the best scored move from index onwards
+   * into index, so a search loop only pays for the moves it visits
+   *
+   * @param int index of the next move to be searched
+   * @return the best scored move not searched yet
+   */
+  Move pickMove(int index) {
+    int best = index;
+
+    for (int i = index + 1; i < count; i++) {
+      if (scores[i] > scores[best])
+        best = i;
+    }
+
+    swap(moves[index], moves[best]);
+    swap(scores[index], scores[best]);
+
+    return moves[index];
+  }
+};
+
 #endif
@@ -0,0 +1,249 @@
+#ifndef NNUE_H
+#define NNUE_H
+
+#include "bitset64.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/* Layer sizes of the network, the first two for every perspective */
+#define NNUE_INPUTS 769
+#define NNUE_L1 4096
+#define NNUE_L2 256
+#define NNUE_L3 64
+#define NNUE_L4 32
+
+/* Header of the weights file, "SNNW" and its format version, with float
+ * or with quantized weights */
+#define NNUE_MAGIC 0x574E4E53
+#define NNUE_VERSION 1
+#define NNUE_QUANTIZED_VERSION 2
+
+/* Quantized activation of 1.0, the most an int8 weight is multiplied by
+ * without saturating the int16 pair sums of the kernels */
+#define NNUE_ACT_ONE 127
+
+/* Largest scale of the quantized accumulators, which keeps the squares of
+ * the activation within 32 bits */
+#define NNUE_MAX_ACC_SCALE 4096
+
+/* Largest shift of the weight scale of a quantized dense layer, which
+ * keeps its biases within 32 bits */
+#define NNUE_MAX_SHIFT 16
+
+/* Dense layers after the first one, each with its own weight scale */
+#define NNUE_DENSE_LAYERS 5
+
+/* Pieces changed by a move: the moving piece, and a captured piece, a
+ * promoted piece or a castling rook */
+#define NNUE_MAX_DIRTY 3
+
+/* Positions from the root of a search, deeper than any search */
+#define ACCUMULATOR_STACK_SIZE 160
+
+using namespace std;
+
+/* Instruction sets of the native evaluator, chosen at runtime */
+enum SimdLevel { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 };
+
+/*
+ * Pieces whose features change with a move. A piece added to the board has
+ * no origin square and a piece removed has no target square, both -1
+ */
+typedef struct {
+  int count;
+  int piece[NNUE_MAX_DIRTY];
+  int from[NNUE_MAX_DIRTY];
+  int to[NNUE_MAX_DIRTY];
+  int turn;
+} DirtyPieces;
+
+/*
+ * Outputs of the first layer for both perspectives, white first, before
+ * the activation, and the changes from the position before. The quantized
+ * network keeps them as int16 scaled by its accumulator scale
+ */
+typedef struct {
+  union {
+    alignas(64) float values[2][NNUE_L1];
+    alignas(64) int16_t qvalues[2][NNUE_L1];
+  };
+  DirtyPieces dirty;
+  bool computed;
+} Accumulator;
+
+/*
+ * Accumulators of the positions from the root of a search to the current
+ * one. Moves push entries that are only computed when a position is
+ * evaluated, from the nearest computed entry and the dirty pieces of the
+ * moves in between
+ */
+typedef struct {
+  vector<Accumulator> entries;
+  int top;
+} AccumulatorStack;
+
+/**
+ * Index of the input of a piece on a square for a perspective. White
+ * pieces planes go first and black pieces planes after them, and the black
+ * perspective mirrors the ranks
+ *
+ * @param int perspective, 0 for white and 1 for black
+ * @param int index of the piece bitboard
+ * @param int square of the piece
+ * @return index of the input
+ */
+inline int nnue_feature(int perspective, int piece, int square) {
+  int plane = 1 + ((piece % 2) * 6 + piece / 2) * 64;
+  return plane + ((perspective == 0) ? square : (square ^ 56));
+}
+
+/**
+ * Returns the widest instruction set of the native evaluator that the CPU
+ * supports
+ *
+ * @return instruction set
+ */
+SimdLevel best_simd_level();
+
+/*
+ * Native evaluator of the value network. The first layer is kept in the
+ * accumulators, so a leaf only computes the layers after it. The dense
+ * layers skip the zero activations, and the kernels run with AVX2 or
+ * AVX-512 when the CPU has them
+ *
+ * The weights file starts with NNUE_MAGIC and NNUE_VERSION as 32 bit
+ * integers, followed by the weights and biases of every layer as little
+ * endian floats: the first layer of the white and of the black
+ * perspective, the second layer of both, and the three shared layers. The
+ * weights are stored input major, as Keras kernels
+ *
+ * A quantized weights file has NNUE_QUANTIZED_VERSION instead, followed by
+ * the accumulator scale and the shift of the weight scale of every dense
+ * layer after the first one as int32, and the layers in the same order:
+ * int16 weights and biases of the first layer, scaled by the accumulator
+ * scale, and int8 weights scaled by 1 << shift with int32 biases scaled by
+ * NNUE_ACT_ONE << shift. Every activation is quantized to uint8 between 0
+ * and NNUE_ACT_ONE, so the whole forward pass runs on integers
+ */
+class NNUE {
+private:
+  bool quantized;
+
+  vector<float> weights1[2];
+  vector<float> bias1[2];
+  vector<float> weights2[2];
+  vector<float> bias2[2];
+  vector<float> weights3;
+  vector<float> bias3;
+  vector<float> weights4;
+  vector<float> bias4;
+  vector<float> weights5;
+  float bias5;
+
+  /* Quantized weights, the int8 ones grouped for the kernels */
+  vector<int16_t> qweights1[2];
+  vector<int16_t> qbias1[2];
+  vector<int8_t> qweights2[2];
+  vector<int32_t> qbias2[2];
+  vector<int8_t> qweights3;
+  vector<int32_t> qbias3;
+  vector<int8_t> qweights4;
+  vector<int32_t> qbias4;
+  vector<int8_t> qweights5;
+  int32_t qbias5;
+
+  int32_t acc_scale;
+  int32_t shifts[NNUE_DENSE_LAYERS];
+
+  /* Activation of every accumulator value between 0 and acc_scale */
+  vector<uint8_t> acc_activation;
+
+  SimdLevel simd;
+
+  /**
+   * Loads the weights of the quantized network, after the header
+   *
+   * @param ifstream & weights file
+   * @return whether the scales are valid
+   */
+  bool loadQuantized(ifstream &file);
+
+  /**
+   * Computes an accumulator from the one of the position before it
+   *
+   * @param const Accumulator * accumulator of the position before
+   * @param Accumulator * accumulator computed, with its dirty pieces set
+   */
+  void update(const Accumulator *previous, Accumulator *acc);
+
+  /**
+   * Computes the layers after the first one of the quantized network
+   *
+   * @param const Accumulator * computed accumulator of the position
+   * @return evaluation in centipawns from the white point of view
+   */
+  float evaluateQuantized(const Accumulator *acc);
+
+public:
+  NNUE();
+
+  /**
+   * Loads the weights from a file, float or quantized
+   *
+   * @param const string & path of the weights file
+   * @return whether the file exists and has the expected format and size
+   */
+  bool load(const string &path);
+
+  /**
+   * Returns whether the weights loaded are quantized
+   *
+   * @return true if the accumulators are int16 and the layers integer
+   */
+  bool isQuantized();
+
+  /**
+   * Computes an accumulator from scratch
+   *
+   * @param Accumulator * accumulator computed
+   * @param const Bitset64 * piece bitboards of the position
+   * @param int side to move
+   */
+  void refresh(Accumulator *acc, const Bitset64 *pieces_bb, int turn);
+
+  /**
+   * Computes the layers after the first one
+   *
+   * @param const Accumulator * computed accumulator of the position
+   * @return evaluation in centipawns from the white point of view
+   */
+  float evaluate(const Accumulator *acc);
+
+  /**
+   * Evaluates the position on top of a stack, computing the accumulators
+   * missing from the nearest computed one
+   *
+   * @param AccumulatorStack * stack whose root entry is computed
+   * @return evaluation in centipawns from the white point of view
+   */
+  float evaluate(AccumulatorStack *stack);
+
+  /**
+   * Sets the instruction set of the kernels
+   *
+   * @param SimdLevel instruction set
+   * @return false if the CPU does not support it, then it is not changed
+   */
+  bool setSimd(SimdLevel level);
+
+  /**
+   * Returns the instruction set of the kernels
+   *
+   * @return instruction set
+   */
+  SimdLevel getSimd();
+};
+
+#endif
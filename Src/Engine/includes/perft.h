@@ -0,0 +1,125 @@
+#ifndef PERFT_H
+#define PERFT_H
+
+#include "bitboard.h"
+#include "lookup_table.h"
+#include "move.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/* Depth the tree is split at into tasks of the parallel perft */
+#define PERFT_SPLIT_DEPTH 2
+
+/* Subtrees below this depth are cheaper to count than to look up */
+#define PERFT_CACHE_MIN_DEPTH 2
+
+using namespace std;
+
+/*
+ * Perft cache entry
+ *
+ * The data holds the node count of the subtree in its lower 56 bits and
+ * the depth in the upper 8 bits. As in the transposition table, the key
+ * is stored XORed with the data so torn entries fail the verification
+ */
+typedef struct {
+  atomic<uint64_t> key;
+  atomic<uint64_t> data;
+} PerftEntry;
+
+/*
+ * Cache of subtree node counts shared by the perft threads, keyed by the
+ * Zobrist hash of the position and the depth of the subtree. A bucket has
+ * an entry kept for the deepest subtree and an entry always replaced. The
+ * number of buckets is rounded down to a power of two
+ */
+class PerftCache {
+private:
+  PerftEntry *entries;
+  size_t bucketCount;
+
+public:
+  PerftCache(size_t mb);
+
+  ~PerftCache();
+
+  PerftCache(const PerftCache &) = delete;
+
+  PerftCache &operator=(const PerftCache &) = delete;
+
+  /**
+   * Looks up the node count of a subtree
+   *
+   * @param uint64_t Zobrist key of the position
+   * @param int depth of the subtree
+   * @param uint64_t * where the node count is written if found
+   * @return whether the subtree was found
+   */
+  bool probe(uint64_t key, int depth, uint64_t *nodes);
+
+  /**
+   * Stores the node count of a subtree
+   *
+   * @param uint64_t Zobrist key of the position
+   * @param int depth of the subtree
+   * @param uint64_t node count
+   */
+  void store(uint64_t key, int depth, uint64_t nodes);
+};
+
+/**
+ * Counts the leaf nodes of the legal move tree of a position
+ *
+ * @param Bitboard * position to count, restored before returning
+ * @param int depth of the tree
+ * @param PerftCache * cache of subtree counts, or nullptr for none
+ * @return number of leaf nodes
+ */
+uint64_t perft(Bitboard *bb, int depth, PerftCache *cache = nullptr);
+
+/**
+ * Counts the leaf nodes of the legal move tree of a position in parallel.
+ * The tree is split into a task for every move sequence of the first
+ * PERFT_SPLIT_DEPTH plies, and the threads keep taking the next pending
+ * task until there are none left
+ *
+ * @param const Bitboard & position to count
+ * @param int depth of the tree
+ * @param int number of threads
+ * @param PerftCache * cache shared by the threads, or nullptr for none
+ * @return number of leaf nodes
+ */
+uint64_t parallel_perft(const Bitboard &bb, int depth, int threads,
+                        PerftCache *cache = nullptr);
+
+/**
+ * Counts the leaf nodes under every root move in parallel, printing each
+ * subtotal as "<move>: <nodes>" with the move in UCI notation
+ *
+ * @param const Bitboard & position to count
+ * @param int depth of the tree, at least 1
+ * @param int number of threads
+ * @param PerftCache * cache shared by the threads, or nullptr for none
+ * @return number of leaf nodes
+ */
+uint64_t divide(const Bitboard &bb, int depth, int threads,
+                PerftCache *cache = nullptr);
+
+/**
+ * Runs the perft tests of an EPD file, one position per line followed by
+ * its expected counts, as in "<fen> ;D1 20 ;D2 400". Prints whether every
+ * count passes with its nodes/sec, and a summary of the whole suite
+ *
+ * @param LookupTable * initialized lookup table
+ * @param const string & path of the EPD file
+ * @param int deepest count checked, or 0 to check all of them
+ * @param int number of threads of every perft
+ * @param PerftCache * cache shared by the tests, or nullptr for none
+ * @return number of failed positions, or -1 if the file cannot be read
+ */
+int run_perft_suite(LookupTable *lut, const string &path, int max_depth,
+                    int threads, PerftCache *cache = nullptr);
+
+#endif
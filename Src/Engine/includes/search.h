@@ -0,0 +1,252 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "bitboard.h"
+#include "eval_cache.h"
+#include "model.h"
+#include "move.h"
+#include "transposition_table.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* Search scores, mate scores are reduced by the distance to the mate */
+#define INF_SCORE 32001
+#define MATE_SCORE 32000
+#define MAX_DEPTH 128
+#define MATE_BOUND (MATE_SCORE - MAX_DEPTH)
+
+/* Time in ms kept aside for the communication with the GUI */
+#define MOVE_OVERHEAD 30
+
+/* Moves left in the game assumed when the GUI does not send movestogo */
+#define DEFAULT_MOVES_TO_GO 30
+
+/* Nodes searched between two checks of the search limits and the stop
+ * signal, a power of two */
+#define CHECK_NODES 256
+
+/* Search threads of the Lazy SMP search */
+#define DEFAULT_THREADS 1
+#define MAX_THREADS 256
+
+/* Move ordering scores, captures are ordered by MVV-LVA and quiet moves by
+ * killers and then by history */
+#define TT_MOVE_SCORE 1000000
+#define CAPTURE_SCORE 100000
+#define KILLER_SCORE 90000
+#define MAX_HISTORY 80000
+
+using namespace std;
+
+/* Limits of a search, as sent in the UCI go command. Absent time limits
+ * are -1 and absent depth or nodes limits are 0 */
+typedef struct {
+  int time[2];
+  int inc[2];
+  int movesToGo;
+  int moveTime;
+  int depth;
+  uint64_t nodes;
+  bool infinite;
+  bool ponder;
+} SearchLimits;
+
+/* Signals shared by the UCI thread and the search threads, and nodes
+ * searched by all of them. While pondering the time limits are ignored
+ * until a ponderhit. The evaluation cache statistics of all the threads
+ * are added when the search returns */
+typedef struct {
+  atomic<bool> stop;
+  atomic<bool> ponder;
+  atomic<uint64_t> nodes;
+  atomic<uint64_t> cacheProbes;
+  atomic<uint64_t> cacheHits;
+} SearchSignals;
+
+/* Buffers of the children of a frontier node evaluated together. They
+ * take about 25 KB, so every thread reuses its own instead of keeping them
+ * in the stack frames of the search */
+typedef struct {
+  Bitset64 piecesBB[MAX_MOVES][12];
+  int turns[MAX_MOVES];
+  float evals[MAX_MOVES];
+  int scores[MAX_MOVES];
+
+  /* Children not found in the evaluation cache, and their keys */
+  int missing[MAX_MOVES];
+  uint64_t keys[MAX_MOVES];
+} FrontierBuffer;
+
+/* State of a search thread. Thread 0 is the main thread, the one managing
+ * the time and reporting the search, the others are helpers */
+typedef struct {
+  SearchLimits limits;
+  SearchSignals *signals;
+  chrono::steady_clock::time_point start;
+  int64_t softLimit;
+  int64_t hardLimit;
+  uint64_t nodes;
+  int threadId;
+  int rootDepth;
+  bool stopped;
+
+  /* Evaluations looked up in the evaluation cache and found */
+  uint64_t cacheProbes;
+  uint64_t cacheHits;
+
+  /* Last completed iteration */
+  int completedDepth;
+  int bestScore;
+  Move bestMove;
+
+  /* Move ordering tables */
+  Move killers[MAX_DEPTH][2];
+  int history[2][SQUARES][SQUARES];
+
+  /* Frontier buffers of the thread */
+  FrontierBuffer *frontier;
+} SearchInfo;
+
+/**
+ * Returns limits without any restriction, the search runs until the
+ * maximum depth
+ *
+ * @return empty search limits
+ */
+SearchLimits init_search_limits();
+
+/**
+ * Allocates the time of a search from the limits for the side to move.
+ * The soft limit is checked between iterations and the hard limit aborts
+ * the iteration in progress
+ *
+ * @param SearchInfo * search whose soft and hard limits are set
+ * @param Color side to move
+ */
+void init_time_management(SearchInfo *info, Color side);
+
+/**
+ * Milliseconds elapsed since the start of the search
+ *
+ * @param const SearchInfo * running search
+ * @return elapsed time in ms
+ */
+int64_t elapsed_ms(const SearchInfo *info);
+
+/**
+ * Fixed depth alpha beta search. Scores are from the white point of view,
+ * white maximizes and black minimizes
+ *
+ * @param Bitboard * position to search
+ * @param int remaining depth
+ * @param int distance to the root
+ * @param int alpha
+ * @param int beta
+ * @param ChessNN & network evaluating the leaves
+ * @param TranspositionTable & shared transposition table
+ * @param EvalCache & shared cache of the evaluations of the leaves
+ * @param SearchInfo * running search, stopped when a limit is reached
+ * @return score of the position and best move found
+ */
+pair<int, Move> alphabeta(Bitboard *bb, int ply, int height, int a, int b,
+                          ChessNN &nn, TranspositionTable &tt,
+                          EvalCache &cache, SearchInfo *info);
+
+/**
+ * Iterative deepening loop of a search thread. Helper threads skip some
+ * depths so the threads spread over several depths
+ *
+ * @param Bitboard * position to search, owned by the thread
+ * @param SearchInfo * state of the thread
+ * @param ChessNN & network evaluating the leaves
+ * @param TranspositionTable & shared transposition table
+ * @param EvalCache & shared cache of the evaluations of the leaves
+ */
+void iterative_deepening(Bitboard *bb, SearchInfo *info, ChessNN &nn,
+                         TranspositionTable &tt, EvalCache &cache);
+
+/**
+ * Lazy SMP search within the given limits. Every thread searches the root
+ * sharing the transposition table and the evaluation cache, and the main
+ * thread prints a UCI info line after every completed iteration and the
+ * evaluation cache statistics at the end
+ *
+ * @param Bitboard * position to search
+ * @param const SearchLimits & limits of the search
+ * @param ChessNN & network evaluating the leaves
+ * @param TranspositionTable & shared transposition table
+ * @param EvalCache & shared cache of the evaluations of the leaves
+ * @param SearchSignals * signals stopping the search, holding the exact
+ * count of nodes searched and the cache statistics when it returns
+ * @param int number of search threads
+ * @return best move of the deepest completed iteration
+ */
+Move search(Bitboard *bb, const SearchLimits &limits, ChessNN &nn,
+            TranspositionTable &tt, EvalCache &cache, SearchSignals *signals,
+            int threads);
+
+/**
+ * Follows the best moves stored in the transposition table from a root
+ * move, checking they are legal in the position reached
+ *
+ * @param Bitboard * root position, restored before returning
+ * @param Move best move of the root
+ * @param int maximum length of the variation
+ * @param TranspositionTable & transposition table of the search
+ * @param Move * where the moves of the variation are written
+ * @return length of the variation
+ */
+int principal_variation(Bitboard *bb, Move best_move, int depth,
+                        TranspositionTable &tt, Move *pv);
+
+/*
+ * Worker thread running the UCI searches, so the UCI thread keeps reading
+ * commands such as stop, ponderhit or isready while it searches
+ */
+class SearchThread {
+private:
+  thread worker;
+  SearchSignals signals;
+
+  /* Set by the worker when its search is over and bestmove is only
+   * waiting for a stop or a ponderhit */
+  atomic<bool> finished;
+
+  /* Set when the GUI allows sending bestmove */
+  atomic<bool> released;
+
+public:
+  SearchThread();
+
+  ~SearchThread();
+
+  /**
+   * Starts searching a copy of the position, printing bestmove at the end
+   *
+   * @param const Bitboard & position to search
+   * @param const SearchLimits & limits of the search
+   * @param ChessNN & network evaluating the leaves
+   * @param TranspositionTable & shared transposition table
+   * @param EvalCache & shared cache of the evaluations of the leaves
+   * @param int number of search threads
+   */
+  void start(const Bitboard &bb, const SearchLimits &limits, ChessNN &nn,
+             TranspositionTable &tt, EvalCache &cache, int threads);
+
+  /**
+   * Stops the running search, if any, and waits for its bestmove
+   */
+  void stop();
+
+  /**
+   * The opponent played the expected move, so the ponder search goes on
+   * under the time limits
+   */
+  void ponderhit();
+};
+
+#endif
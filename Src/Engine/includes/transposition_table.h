@@ -0,0 +1,137 @@
+#ifndef TRANSPOSITION_TABLE_H
+#define TRANSPOSITION_TABLE_H
+
+#include "move.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/* Size of the transposition table in MB */
+#define DEFAULT_HASH_MB 16
+#define MIN_HASH_MB 1
+#define MAX_HASH_MB 65536
+
+/* Entries of a bucket, so a bucket fills a 64 byte cache line */
+#define TT_BUCKET_SIZE 4
+
+/* Kind of bound of a stored score */
+#define BOUND_NONE 0
+#define BOUND_UPPER 1
+#define BOUND_LOWER 2
+#define BOUND_EXACT 3
+
+using namespace std;
+
+/* Unpacked contents of a transposition table entry */
+typedef struct {
+  Move move;
+  int score;
+  int depth;
+  int bound;
+} TTData;
+
+/*
+ * Transposition table entry
+ *
+ * Data encoding format
+ *
+ * bits  0-31 best move
+ * bits 32-47 score (int16_t)
+ * bits 48-55 depth
+ * bits 56-57 bound
+ * bits 58-63 age of the search that stored it
+ *
+ * The key is stored XORed with the data, so an entry torn by two threads
+ * writing it at the same time fails the key verification instead of
+ * returning the data of another position
+ */
+typedef struct {
+  atomic<uint64_t> key;
+  atomic<uint64_t> data;
+} TTEntry;
+
+typedef struct alignas(64) {
+  TTEntry entries[TT_BUCKET_SIZE];
+} TTBucket;
+
+static_assert(sizeof(TTBucket) == 64);
+
+/*
+ * Lockless transposition table shared by every search thread
+ */
+class TranspositionTable {
+private:
+  TTBucket *buckets;
+  size_t bucketCount;
+  unsigned int age;
+
+  /**
+   * Maps a key to its bucket by scaling its upper 32 bits to the number of
+   * buckets, which is below 2^32 for any allowed size
+   *
+   * @param uint64_t Zobrist key of the position
+   * @return bucket where the position is stored
+   */
+  TTBucket &bucket(uint64_t key) {
+    return buckets[((key >> 32) * bucketCount) >> 32];
+  }
+
+public:
+  TranspositionTable(size_t mb);
+
+  ~TranspositionTable();
+
+  TranspositionTable(const TranspositionTable &) = delete;
+
+  TranspositionTable &operator=(const TranspositionTable &) = delete;
+
+  /**
+   * Reallocates the table, discarding every entry. If the allocation fails
+   * bad_alloc is thrown and the current table is kept untouched
+   *
+   * @param size_t new size in MB
+   */
+  void resize(size_t mb);
+
+  /**
+   * Clears every entry of the table
+   */
+  void clear();
+
+  /**
+   * Ages the table at the start of a new search, so the entries of the
+   * previous searches are replaced first
+   */
+  void newSearch();
+
+  /**
+   * Looks up a position
+   *
+   * @param uint64_t Zobrist key of the position
+   * @param TTData * where the entry is unpacked if found
+   * @return whether the position was found
+   */
+  bool probe(uint64_t key, TTData *tt_data);
+
+  /**
+   * Stores a position, replacing the entry of the bucket of the same
+   * position or else the shallowest and oldest one. A non exact score does
+   * not replace a much deeper one of the same position and search
+   *
+   * @param uint64_t Zobrist key of the position
+   * @param Move best move found, or the null move to keep the stored one
+   * @param int score of the position
+   * @param int depth searched
+   * @param int bound of the score
+   */
+  void store(uint64_t key, Move move, int score, int depth, int bound);
+
+  /**
+   * Samples the occupation of the table by the current search
+   *
+   * @return permille of the sampled entries stored by the current search
+   */
+  int hashfull();
+};
+
+#endif
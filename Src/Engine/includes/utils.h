@@ -1,6 +1,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstdint>
 #include <map>
 #include <string>
 
@@ -87,4 +88,18 @@ extern const std::map<std::string, int> squareToCoordinate;
 
 extern const char *asciiPieces[12];
 
+/**
+ * Pseudo random generator (xorshift64star) of the magic numbers and the
+ * Zobrist keys
+ *
+ * @param uint64_t * state of the generator
+ * @return next pseudo random number
+ */
+constexpr uint64_t random_u64(uint64_t *seed) {
+  *seed ^= *seed >> 12;
+  *seed ^= *seed << 25;
+  *seed ^= *seed >> 27;
+  return *seed * 2685821657736338717ULL;
+}
+
 #endif
@@ -0,0 +1,49 @@
+#ifndef ZOBRIST_H
+#define ZOBRIST_H
+
+#include "utils.h"
+#include <cstdint>
+
+/* Seed of the generator of the Zobrist keys */
+#define ZOBRIST_SEED 1070372ULL
+
+/*
+ * Zobrist keys of every component of a position
+ *
+ * The hash of a position is the XOR of the keys of each piece on its
+ * square, of the castling rights (indexed by the 4 castling bits), of the
+ * en passant file if there is an en passant square and of the side key if
+ * black is to move
+ */
+typedef struct {
+  uint64_t pieces[12][SQUARES];
+  uint64_t castling[16];
+  uint64_t enPassant[FILES];
+  uint64_t side;
+} ZobristKeys;
+
+/* Keys shared by every position and generated at compile time */
+inline constexpr ZobristKeys zobrist = [] {
+  ZobristKeys keys{};
+  uint64_t seed = ZOBRIST_SEED;
+
+  for (int piece = 0; piece < 12; piece++) {
+    for (int square = 0; square < SQUARES; square++) {
+      keys.pieces[piece][square] = random_u64(&seed);
+    }
+  }
+
+  for (int rights = 0; rights < 16; rights++) {
+    keys.castling[rights] = random_u64(&seed);
+  }
+
+  for (int file = 0; file < FILES; file++) {
+    keys.enPassant[file] = random_u64(&seed);
+  }
+
+  keys.side = random_u64(&seed);
+
+  return keys;
+}();
+
+#endif
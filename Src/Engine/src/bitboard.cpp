@@ -2,7 +2,9 @@
 #include "../includes/lookup_table.h"
 #include "../includes/move.h"
 #include "../includes/utils.h"
+#include "../includes/zobrist.h"
 #include <array>
+#include <cassert>
 #include <bit>
 #include <bitset>
 #include <iostream>
@@ -59,17 +61,16 @@ Bitboard::Bitboard(LookupTable *lut) {
   piecesBB[BLACK_KING_BB] = BLACK_KING_INIT;
 
   turn = WHITE;
-  castlingRights.reset();
-  castlingRights.flip();
+  castlingRights = ALL_CASTLING;
   enPassantSq = no_square;
 
+  accumulators = nullptr;
+
   updateDerivedBitboards();
-  nonSlidingAttacks();
-  slidingAttacks();
-  generateMoves();
+  hash = computeHash();
 }
 
-Bitboard::Bitboard(LookupTable *lut, bitset<64> pieces[12], bitset<4> cR,
+Bitboard::Bitboard(LookupTable *lut, Bitset64 pieces[12], uint8_t cR,
                    int epSq, Color side) {
   setLookupTable(lut);
 
@@ -81,267 +82,89 @@ Bitboard::Bitboard(LookupTable *lut, bitset<64> pieces[12], bitset<4> cR,
   castlingRights = cR;
   enPassantSq = epSq;
 
+  accumulators = nullptr;
+
   updateDerivedBitboards();
-  nonSlidingAttacks();
-  slidingAttacks();
-  generateMoves();
+  hash = computeHash();
 }
 
 void Bitboard::setLookupTable(LookupTable *lut) { lookupTable = lut; }
 
 Color Bitboard::getTurn() { return turn; }
 
-vector<Move> Bitboard::getMoveList() { return moveList; }
-
-vector<Move> Bitboard::getMoveHistory() { return moveHistory; }
-
-bitset<64> *Bitboard::getPieces() { return piecesBB; }
+uint64_t Bitboard::getHash() { return hash; }
 
-bitset<64> Bitboard::generateKingAttacks(int square) {
-  bitset<64> king = lookupTable->piece_lookup[square];
+Bitset64 *Bitboard::getPieces() { return piecesBB; }
 
-  bitset<64> a_file_clipping = king & lookupTable->clear_file[0];
-  bitset<64> h_file_clipping = king & lookupTable->clear_file[7];
-
-  bitset<64> left_move = a_file_clipping >> 1;
-  bitset<64> right_move = h_file_clipping << 1;
-  bitset<64> upward_move = king << 8;
-  bitset<64> downward_move = king >> 8;
-  bitset<64> diagonal_left_up_move = a_file_clipping << 7;
-  bitset<64> diagonal_left_down_move = a_file_clipping >> 9;
-  bitset<64> diagonal_right_up_move = h_file_clipping << 9;
-  bitset<64> diagonal_right_down_move = h_file_clipping >> 7;
-
-  return (left_move | right_move | upward_move | downward_move |
-          diagonal_right_down_move | diagonal_left_down_move |
-          diagonal_left_up_move | diagonal_right_up_move);
+Bitset64 Bitboard::generateKingAttacks(int square) {
+  return king_attacks[square];
 }
 
-bitset<64> Bitboard::generateKnightAttacks(int square) {
-  bitset<64> knight = lookupTable->piece_lookup[square];
-
-  bitset<64> a_file_clipping = knight & lookupTable->clear_file[0];
-  bitset<64> h_file_clipping = knight & lookupTable->clear_file[7];
-  bitset<64> b_file_clipping = knight & lookupTable->clear_file[1];
-  bitset<64> g_file_clipping = knight & lookupTable->clear_file[6];
-
-  bitset<64> up_left_move = a_file_clipping << 15;
-  bitset<64> up_right_move = h_file_clipping << 17;
-  bitset<64> down_left_move = a_file_clipping >> 17;
-  bitset<64> down_right_move = h_file_clipping >> 15;
-  bitset<64> right_up_move = (h_file_clipping & g_file_clipping) << 10;
-  bitset<64> right_down_move = (h_file_clipping & g_file_clipping) >> 6;
-  bitset<64> left_up_move = (a_file_clipping & b_file_clipping) << 6;
-  bitset<64> left_down_move = (a_file_clipping & b_file_clipping) >> 10;
-
-  return (up_left_move | up_right_move | down_left_move | down_right_move |
-          right_up_move | right_down_move | left_up_move | left_down_move);
+Bitset64 Bitboard::generateKnightAttacks(int square) {
+  return knight_attacks[square];
 }
 
-bitset<64> Bitboard::generatePawnAttacks(Color color, int square) {
-  bitset<64> pawn;
-
-  pawn = lookupTable->piece_lookup[square];
-
-  bitset<64> a_file_clipping = pawn & lookupTable->clear_file[0];
-  bitset<64> h_file_clipping = pawn & lookupTable->clear_file[7];
-
-  bitset<64> attacks;
-  if (color == WHITE) {
-    attacks = a_file_clipping << 7 | h_file_clipping << 9;
-  } else {
-    attacks = a_file_clipping >> 9 | h_file_clipping >> 7;
-  }
-
-  return attacks;
+Bitset64 Bitboard::generatePawnAttacks(Color color, int square) {
+  return pawn_attacks[color][square];
 }
 
-bitset<64> Bitboard::generatePawnMoves(Color color, int square) {
-  bitset<64> pawn;
+Bitset64 Bitboard::generatePawnMoves(Color color, int square) {
+  Bitset64 pawn;
 
   pawn = lookupTable->piece_lookup[square];
-  bitset<64> pawn_one_step, pawn_two_steps;
+  Bitset64 pawn_one_step, pawn_two_steps;
 
   /* dumb7fill for two steps generation wiht an unrolled loop*/
   if (color == WHITE) {
-    pawn_one_step = (pawn << 8) & emptySquares;
+    pawn_one_step = (pawn << 8) & ~allPieces;
     pawn_two_steps =
-        ((pawn_one_step & lookupTable->mask_rank[2]) << 8) & emptySquares;
+        ((pawn_one_step & lookupTable->mask_rank[2]) << 8) & ~allPieces;
   } else {
-    pawn_one_step = (pawn >> 8) & emptySquares;
+    pawn_one_step = (pawn >> 8) & ~allPieces;
     pawn_two_steps =
-        ((pawn_one_step & lookupTable->mask_rank[5]) >> 8) & emptySquares;
+        ((pawn_one_step & lookupTable->mask_rank[5]) >> 8) & ~allPieces;
   }
 
-  bitset<64> moves = pawn_one_step | pawn_two_steps;
+  Bitset64 moves = pawn_one_step | pawn_two_steps;
 
   return moves;
 }
 
-bitset<64> Bitboard::generateDiagonalAttacks(int square) {
-  bitset<64> forward, reverse;
-
-  int rank_index = square / 8;
-  int file_index = square % 8;
-  int diagonal_index = (rank_index - file_index) & 15;
-
-  // Getting the pieces assocciated to the diagonal of the sliding piece
-  bitset<64> occupancy = allPieces;
-  bitset<64> diagonal =
-      (bitset<64>)(lookupTable->mask_diagonal[diagonal_index].to_ulong() -
-                   lookupTable->piece_lookup[square].to_ulong());
-
-  forward = occupancy & diagonal;
-  reverse = (bitset<64>)byteswap(forward.to_ulong());
-
-  // Getting everything but the sliding piece given the diagonal pieces
-  forward = (bitset<64>)(forward.to_ulong() -
-                         (lookupTable->piece_lookup[square]).to_ulong());
-  reverse =
-      (bitset<64>)(reverse.to_ulong() -
-                   (byteswap((lookupTable->piece_lookup[square]).to_ulong())));
-
-  forward ^= (bitset<64>)byteswap(reverse.to_ulong());
-  forward &= diagonal;
-
-  return forward;
-}
-
-bitset<64> Bitboard::generateAntiDiagonalAttacks(int square) {
-  bitset<64> forward, reverse;
-
-  int rank_index = square / 8;
-  int file_index = square % 8;
-  int anti_diagonal_index = (rank_index + file_index) ^ 7;
-
-  // Getting the pieces assocciated to the antidiagonal of the sliding piece
-  bitset<64> occupancy = allPieces;
-  bitset<64> anti_diagonal =
-      (bitset<64>)(lookupTable->mask_antidiagonal[anti_diagonal_index]
-                       .to_ulong() -
-                   lookupTable->piece_lookup[square].to_ulong());
-
-  forward = occupancy & anti_diagonal;
-  reverse = (bitset<64>)byteswap(forward.to_ulong());
-
-  // Getting everything but the sliding piece given the pieces on the
-  // antidiagonal
-  forward = (bitset<64>)(forward.to_ulong() -
-                         (lookupTable->piece_lookup[square]).to_ulong());
-  reverse =
-      (bitset<64>)(reverse.to_ulong() -
-                   (byteswap((lookupTable->piece_lookup[square]).to_ulong())));
-
-  forward ^= (bitset<64>)byteswap(reverse.to_ulong());
-  forward &= anti_diagonal;
-
-  return forward;
-}
-
-bitset<64> Bitboard::generateFileAttacks(int square) {
-  bitset<64> forward, reverse;
-
-  int file_index = square % 8;
-
-  // Getting the pieces assocciated to the file of the sliding piece
-  bitset<64> occupancy = allPieces;
-  bitset<64> file = (bitset<64>)(lookupTable->mask_file[file_index].to_ulong() -
-                                 lookupTable->piece_lookup[square].to_ulong());
-
-  forward = occupancy & file;
-  reverse = (bitset<64>)byteswap(forward.to_ulong());
-
-  // Getting everything but the sliding piece given the pieces on the file
-  forward = (bitset<64>)(forward.to_ulong() -
-                         (lookupTable->piece_lookup[square]).to_ulong());
-  reverse =
-      (bitset<64>)(reverse.to_ulong() -
-                   (byteswap((lookupTable->piece_lookup[square]).to_ulong())));
-
-  forward ^= (bitset<64>)byteswap(reverse.to_ulong());
-  forward &= file;
-
-  return forward;
-}
-
-bitset<64> Bitboard::generateRankAttacks(int square) {
-  int file = square % 8;
-  int rank = square / 8;
-
-  int rank_x8 = rank * 8;
-  int rank_occupancy_x2 = (allPieces >> rank_x8).to_ulong() & 2 * 63;
-
-  bitset<64> attacks =
-      lookupTable->mask_first_rank_attacks[4 * rank_occupancy_x2 + file];
-
-  return attacks << rank_x8;
-}
-
-bitset<64> Bitboard::generateBishopAttacks(int square) {
-  return generateDiagonalAttacks(square) | generateAntiDiagonalAttacks(square);
+Bitset64 Bitboard::generateBishopAttacks(int square) {
+  return bishop_attacks(lookupTable, square, allPieces);
 }
 
-bitset<64> Bitboard::generateRookAttacks(int square) {
-  return generateFileAttacks(square) | generateRankAttacks(square);
+Bitset64 Bitboard::generateRookAttacks(int square) {
+  return rook_attacks(lookupTable, square, allPieces);
 }
 
-bitset<64> Bitboard::generateQueenAttacks(int square) {
+Bitset64 Bitboard::generateQueenAttacks(int square) {
   return generateBishopAttacks(square) | generateRookAttacks(square);
 }
 
-void Bitboard::nonSlidingAttacks() {
-  int i;
-
-  /* Loop over all squares */
-  for (i = 0; i < SQUARES; i++) {
-    /* Get all possible pawn attacks for each color and each square */
-    pawnAttacks[WHITE][i] = generatePawnAttacks(WHITE, i);
-    pawnAttacks[BLACK][i] = generatePawnAttacks(BLACK, i);
-
-    /* Get all possible knight attacks for each square */
-    knightAttacks[i] = generateKnightAttacks(i);
-
-    /* Get all possible king attacks for each square */
-    kingAttacks[i] = generateKingAttacks(i);
-  }
-}
-
-void Bitboard::slidingAttacks() {
-  int i;
+Bitset64 Bitboard::attacksToSquare(int square) {
 
-  /* Loop over all squares */
-  for (i = 0; i < SQUARES; i++) {
-    /* Get all possible bishop attacks for each square */
-    bishopAttacks[i] = generateBishopAttacks(i);
-
-    /* Get all possible rook attacks for each square */
-    rookAttacks[i] = generateRookAttacks(i);
-  }
-}
-
-bitset<64> Bitboard::attacksToSquare(int square) {
-
-  bitset<64> knights, kings, bishopsAndQueens, rooksAndQueens;
+  Bitset64 knights, kings, bishopsAndQueens, rooksAndQueens;
 
   /* Union all the same moveset pieces */
   knights = piecesBB[WHITE_KNIGHTS_BB] | piecesBB[BLACK_KNIGHTS_BB];
   kings = piecesBB[WHITE_KING_BB] | piecesBB[BLACK_KING_BB];
-  bitset<64> queens = piecesBB[WHITE_QUEENS_BB] | piecesBB[BLACK_QUEENS_BB];
+  Bitset64 queens = piecesBB[WHITE_QUEENS_BB] | piecesBB[BLACK_QUEENS_BB];
   bishopsAndQueens =
       piecesBB[WHITE_BISHOPS_BB] | piecesBB[BLACK_BISHOPS_BB] | queens;
   rooksAndQueens = piecesBB[WHITE_ROOKS_BB] | piecesBB[BLACK_ROOKS_BB] | queens;
 
   /* Intersect the pieces with attacks from the square and union everything */
-  return ((pawnAttacks[WHITE][square] & piecesBB[BLACK_PAWNS_BB]) |
-          (pawnAttacks[BLACK][square] & piecesBB[WHITE_PAWNS_BB]) |
-          (knightAttacks[square] & knights) | (kingAttacks[square] & kings) |
-          (bishopAttacks[square] & bishopsAndQueens) |
-          (rookAttacks[square] & rooksAndQueens));
+  return ((pawn_attacks[WHITE][square] & piecesBB[BLACK_PAWNS_BB]) |
+          (pawn_attacks[BLACK][square] & piecesBB[WHITE_PAWNS_BB]) |
+          (knight_attacks[square] & knights) | (king_attacks[square] & kings) |
+          (generateBishopAttacks(square) & bishopsAndQueens) |
+          (generateRookAttacks(square) & rooksAndQueens));
 }
 
-bitset<64> Bitboard::attacksToSquare(int square, Color side) {
+Bitset64 Bitboard::attacksToSquare(int square, Color side) {
 
-  bitset<64> knights, king, bishopsAndQueens, rooksAndQueens;
+  Bitset64 knights, king, bishopsAndQueens, rooksAndQueens;
 
   /* Get the pieces given the side */
   knights =
@@ -349,7 +172,7 @@ bitset<64> Bitboard::attacksToSquare(int square, Color side) {
 
   king = (side == WHITE) ? piecesBB[WHITE_KING_BB] : piecesBB[BLACK_KING_BB];
 
-  bitset<64> queens =
+  Bitset64 queens =
       (side == WHITE) ? piecesBB[WHITE_QUEENS_BB] : piecesBB[BLACK_QUEENS_BB];
 
   bishopsAndQueens = ((side == WHITE) ? piecesBB[WHITE_BISHOPS_BB]
@@ -361,52 +184,49 @@ bitset<64> Bitboard::attacksToSquare(int square, Color side) {
 
   /* Intersect the pieces with attacks from the square and union everything */
   return ((side == WHITE)
-              ? pawnAttacks[WHITE][square] & piecesBB[BLACK_PAWNS_BB]
-              : pawnAttacks[BLACK][square] & piecesBB[WHITE_PAWNS_BB]) |
-         (knightAttacks[square] & knights) | (kingAttacks[square] & king) |
-         (bishopAttacks[square] & bishopsAndQueens) |
-         (rookAttacks[square] & rooksAndQueens);
+              ? pawn_attacks[BLACK][square] & piecesBB[WHITE_PAWNS_BB]
+              : pawn_attacks[WHITE][square] & piecesBB[BLACK_PAWNS_BB]) |
+         (knight_attacks[square] & knights) | (king_attacks[square] & king) |
+         (generateBishopAttacks(square) & bishopsAndQueens) |
+         (generateRookAttacks(square) & rooksAndQueens);
 }
 
 bool Bitboard::isSquareAttacked(Color side, int square) {
+  return isSquareAttacked(side, square, allPieces);
+}
 
-  /* Intersect own pieces with opponent attacks */
-  bitset<64> pawns =
-      (side == WHITE) ? piecesBB[WHITE_PAWNS_BB] : piecesBB[BLACK_PAWNS_BB];
-  if ((pawnAttacks[(side == WHITE) ? BLACK : WHITE][square] & pawns).any())
+bool Bitboard::isSquareAttacked(Color side, int square,
+                                Bitset64 occupancy) {
+  int offset = (side == WHITE) ? 0 : 1;
+
+  /* Non sliding attacks do not depend on the occupancy */
+  if ((pawn_attacks[(side == WHITE) ? BLACK : WHITE][square] &
+       piecesBB[WHITE_PAWNS_BB + offset])
+          .any())
     return true;
 
-  bitset<64> knights =
-      (side == WHITE) ? piecesBB[WHITE_KNIGHTS_BB] : piecesBB[BLACK_KNIGHTS_BB];
-  if ((knightAttacks[square] & knights).any())
+  if ((knight_attacks[square] & piecesBB[WHITE_KNIGHTS_BB + offset]).any())
     return true;
 
-  bitset<64> king =
-      (side == WHITE) ? piecesBB[WHITE_KING_BB] : piecesBB[BLACK_KING_BB];
-  if ((kingAttacks[square] & king).any())
+  if ((king_attacks[square] & piecesBB[WHITE_KING_BB + offset]).any())
     return true;
 
-  bitset<64> queens =
-      (side == WHITE) ? piecesBB[WHITE_QUEENS_BB] : piecesBB[BLACK_QUEENS_BB];
+  Bitset64 queens = piecesBB[WHITE_QUEENS_BB + offset];
 
-  bitset<64> bishopsAndQueens =
-      (side == WHITE) ? piecesBB[WHITE_BISHOPS_BB] : piecesBB[BLACK_BISHOPS_BB];
-  bishopsAndQueens |= bishopsAndQueens | queens;
-  if ((bishopAttacks[square] & bishopsAndQueens).any())
+  Bitset64 bishopsAndQueens = piecesBB[WHITE_BISHOPS_BB + offset] | queens;
+  if ((bishop_attacks(lookupTable, square, occupancy) & bishopsAndQueens).any())
     return true;
 
-  bitset<64> rooksAndQueens =
-      (side == WHITE) ? piecesBB[WHITE_ROOKS_BB] : piecesBB[BLACK_ROOKS_BB];
-  rooksAndQueens |= rooksAndQueens | queens;
-  if ((rookAttacks[square] & rooksAndQueens).any())
+  Bitset64 rooksAndQueens = piecesBB[WHITE_ROOKS_BB + offset] | queens;
+  if ((rook_attacks(lookupTable, square, occupancy) & rooksAndQueens).any())
     return true;
 
   return false;
 }
 
 bool Bitboard::isCheck(Color side) {
-  bitset<64> king = piecesBB[(side == WHITE) ? WHITE_KING_BB : BLACK_KING_BB];
-  int king_square = countr_zero(king.to_ulong());
+  Bitset64 king = piecesBB[(side == WHITE) ? WHITE_KING_BB : BLACK_KING_BB];
+  int king_square = king.lsb();
 
   if (isSquareAttacked((side == WHITE) ? BLACK : WHITE, king_square) == true) {
     return true;
@@ -416,69 +236,29 @@ bool Bitboard::isCheck(Color side) {
 }
 
 bool Bitboard::isCheckmate(Color side) {
-  /* Copy board in case there is no checkmate */
-  Bitboard bitboard_cpy = copyBoard();
-
-  bitset<64> king = piecesBB[(side == WHITE) ? WHITE_KING_BB : BLACK_KING_BB];
-
-  /* Get the position of all the pieces giving check */
-  bitset<64> checks = attacksToSquare(countr_zero(king.to_ulong()),
-                                      (side == WHITE) ? BLACK : WHITE);
-
-  int n_checks = 0;
-  int source_square = no_square;
-  /* Iterate over the position of all the pieces giving check */
-  while (checks.any()) {
-    n_checks++;
-    source_square = countr_zero(checks.to_ulong());
-    checks.set(source_square, false);
-  }
-
-  if (n_checks == 0) {
+  if (isCheck(side) == false) {
     return false;
-  } else if (n_checks == 1) {
-    // Can be improved
-    for (Move m : moveList) {
-      if (makeMove(m) == true) {
-        *this = bitboard_cpy;
-        return false;
-      }
-    }
-  } else {
-    for (Move m : moveList) {
-      if (m.getPiece() == KING) {
-        if (makeMove(m) == true) {
-          *this = bitboard_cpy;
-          return false;
-        }
-      }
-    }
   }
 
-  *this = bitboard_cpy;
-  return true;
+  /* In check without legal moves */
+  MoveList move_list;
+  generateMoves(&move_list);
+  return move_list.empty();
 }
 
 bool Bitboard::isStaleMate(Color side) {
-  /* Check if king is in check */
   if (isCheck(side) == true) {
     return false;
   }
 
-  /* Copy board in case there is no stalemate */
-  Bitboard bitboard_cpy = copyBoard();
-
-  /* If the king is not in check, look if legal moves can be made */
-  int staleMate = true;
-  for (Move m : moveList) {
-    if (makeMove(m) == true) {
-      staleMate = false;
-      *this = bitboard_cpy;
-      break;
-    }
-  }
+  /* Not in check without legal moves */
+  MoveList move_list;
+  generateMoves(&move_list);
+  return move_list.empty();
+}
 
-  return staleMate;
+int Bitboard::kingSquare() {
+  return piecesBB[(turn == WHITE) ? WHITE_KING_BB : BLACK_KING_BB].lsb();
 }
 
 int Bitboard::pieceAtSquare(int square) {
@@ -510,66 +290,76 @@ array<int, 64> Bitboard::getPiecesAtSquares() {
   return pieces;
 }
 
-void Bitboard::generateCastleMoves(Color side) {
+void Bitboard::generateCastleMoves(MoveList *moveList, Color side) {
+  /* The king cannot castle out of check */
+  if (checkers.any()) {
+    return;
+  }
 
   if (side == WHITE) {
     /* White side king castling */
-    if (castlingRights.test(0) == true) {
+    if (castlingRights & WHITE_KING_SIDE) {
       /* Check if squares between king and rook are empty and if any of the
        * end or passing squares are attacked by an opponents piece */
-      if ((emptySquares.test(5) == true && emptySquares.test(6) == true) &&
+      if ((allPieces.test(5) == false && allPieces.test(6) == false) &&
           (isSquareAttacked(BLACK, 5) == false &&
            isSquareAttacked(BLACK, 6) == false)) {
-        moveList.push_back(Move(4, 6, KING_CASTLE, KING, WHITE));
+        moveList->push(Move(4, 6, KING_CASTLE, KING, WHITE));
       }
     }
 
     /* White side queen castling */
-    if (castlingRights.test(1) == true) {
-      if ((emptySquares.test(3) == true && emptySquares.test(2) == true &&
-           emptySquares.test(1) == true) &&
+    if (castlingRights & WHITE_QUEEN_SIDE) {
+      if ((allPieces.test(3) == false && allPieces.test(2) == false &&
+           allPieces.test(1) == false) &&
           (isSquareAttacked(BLACK, 3) == false &&
            isSquareAttacked(BLACK, 2) == false)) {
 
-        moveList.push_back(Move(4, 2, QUEEN_CASTLE, KING, WHITE));
+        moveList->push(Move(4, 2, QUEEN_CASTLE, KING, WHITE));
       }
     }
   } else {
     /* Black side king castling */
-    if (castlingRights.test(2) == true) {
-      if ((emptySquares.test(61) == true && emptySquares.test(62) == true) &&
+    if (castlingRights & BLACK_KING_SIDE) {
+      if ((allPieces.test(61) == false && allPieces.test(62) == false) &&
           (isSquareAttacked(WHITE, 61) == false &&
            isSquareAttacked(WHITE, 62) == false)) {
-        moveList.push_back(Move(60, 62, KING_CASTLE, KING, BLACK));
+        moveList->push(Move(60, 62, KING_CASTLE, KING, BLACK));
       }
     }
     /* Black side queen castling */
-    if (castlingRights.test(3) == true) {
-      if ((emptySquares.test(59) == true && emptySquares.test(58) == true &&
-           emptySquares.test(57) == true) &&
+    if (castlingRights & BLACK_QUEEN_SIDE) {
+      if ((allPieces.test(59) == false && allPieces.test(58) == false &&
+           allPieces.test(57) == false) &&
           (isSquareAttacked(WHITE, 59) == false &&
            isSquareAttacked(WHITE, 58) == false)) {
-        moveList.push_back(Move(60, 58, QUEEN_CASTLE, KING, BLACK));
+        moveList->push(Move(60, 58, QUEEN_CASTLE, KING, BLACK));
       }
     }
   }
 }
 
-void Bitboard::pieceMoves(bitset<64> bb, Color color,
-                          bitset<64> (Bitboard::*move_generator)(Color, int),
-                          bitset<64> (Bitboard::*attack_generator)(Color,
-                                                                   int)) {
+void Bitboard::pieceMoves(MoveList *moveList, Bitset64 bb, Color color,
+                          Bitset64 (Bitboard::*move_generator)(Color, int),
+                          Bitset64 (Bitboard::*attack_generator)(Color, int)) {
   /* Loop over all the pieces in the bitboard */
   while (bb.any()) {
-    /* Extract the less significant bit */
-    int source_square = countr_zero(bb.to_ulong());
+    /* Pop the less significant bit */
+    int source_square = bb.popLsb();
+
+    /* Pinned pawns can only move along the pin line */
+    Bitset64 legal_targets = checkMask;
+    if (pinned.test(source_square)) {
+      legal_targets &= lookupTable->line[kingSquare()][source_square];
+    }
 
     /* Generate quiet moves */
-    bitset<64> moves = (this->*move_generator)(color, source_square);
+    Bitset64 moves =
+        (this->*move_generator)(color, source_square) & legal_targets;
 
     /* Loop over all the moves generated */
     while (moves.any()) {
-      int target_square = countr_zero(moves.to_ulong());
+      int target_square = moves.popLsb();
 
       int flag;
 
@@ -590,31 +380,27 @@ void Bitboard::pieceMoves(bitset<64> bb, Color color,
         flag = QUIET_MOVE;
       }
 
-      moves.set(target_square, false);
-
       if (flag == PROMOTION) {
         /* Generate all possible types of promotion */
         for (int i = KNIGHT_PROMOTION; i <= QUEEN_PROMOTION; i++) {
-          moveList.push_back(
-              Move(source_square, target_square, i, PAWN, color));
+          moveList->push(Move(source_square, target_square, i, PAWN, color));
         }
       } else {
-        moveList.push_back(
-            Move(source_square, target_square, flag, PAWN, color));
+        moveList->push(Move(source_square, target_square, flag, PAWN, color));
       }
     }
 
-    bitset<64> pieces;
+    Bitset64 pieces;
     (color == WHITE) ? pieces = allBlackPieces : pieces = allWhitePieces;
 
     /* Generate attacks and captures */
-    bitset<64> attacks = (this->*attack_generator)(color, source_square);
-    bitset<64> captures = attacks & pieces;
+    Bitset64 attacks = (this->*attack_generator)(color, source_square);
+    Bitset64 captures = attacks & pieces & legal_targets;
 
     /* Loop over all the captures generated */
     int flag = CAPTURE;
     while (captures.any()) {
-      int target_square = countr_zero(captures.to_ulong());
+      int target_square = captures.popLsb();
 
       /* Check for promotion captures */
       int promotion_rank = (color == WHITE) ? 7 : 0;
@@ -624,123 +410,226 @@ void Bitboard::pieceMoves(bitset<64> bb, Color color,
         flag = PROMOTION_CAPTURE;
       }
 
-      captures.set(target_square, false);
-
       /* Generate all possible promotion captures */
       if (flag == PROMOTION_CAPTURE) {
         for (int i = KNIGHT_PROMOTION_CAPTURE; i <= QUEEN_PROMOTION_CAPTURE;
              i++) {
-          moveList.push_back(
-              Move(source_square, target_square, i, PAWN, color));
+          moveList->push(Move(source_square, target_square, i, PAWN, color));
         }
       } else {
-        moveList.push_back(
+        moveList->push(
             Move(source_square, target_square, CAPTURE, PAWN, color));
       }
     }
 
     /* Generate en passant capture */
     if (enPassantSq != no_square) {
-      if ((attacks & lookupTable->piece_lookup[enPassantSq]).any() == true) {
-        moveList.push_back(
+      if ((attacks & lookupTable->piece_lookup[enPassantSq]).any() == true &&
+          isLegalEnPassant(source_square, color) == true) {
+        moveList->push(
             Move(source_square, enPassantSq, EP_CAPTURE, PAWN, color));
       }
     }
-    /* Pop the less significant bit */
-    bb.set(source_square, false);
   }
 }
 
-void Bitboard::pieceMoves(bitset<64> bb, Color color,
-                          bitset<64> (Bitboard::*attackGenerator)(int),
+void Bitboard::pieceMoves(MoveList *moveList, Bitset64 bb, Color color,
+                          Bitset64 (Bitboard::*attackGenerator)(int),
                           int piece_type) {
   /* Loop over all the pieces in the bitboard */
   while (bb.any()) {
-    /* Extract the less significant bit */
-    int source_square = countr_zero(bb.to_ulong());
+    /* Pop the less significant bit */
+    int source_square = bb.popLsb();
 
-    /* Generate attacks */
-    bitset<64> attacks = (this->*attackGenerator)(source_square);
+    /* Generate attacks that block or capture a checking piece */
+    Bitset64 attacks = (this->*attackGenerator)(source_square) & checkMask;
+
+    /* Pinned pieces can only move along the pin line */
+    if (pinned.test(source_square)) {
+      attacks &= lookupTable->line[kingSquare()][source_square];
+    }
 
     /* Generate quiet moves */
-    bitset<64> moves = attacks & emptySquares;
+    Bitset64 moves = attacks & ~allPieces;
 
     /* Generate captures */
-    bitset<64> pieces;
+    Bitset64 pieces;
     (color == WHITE) ? pieces = allBlackPieces : pieces = allWhitePieces;
-    bitset<64> captures = attacks & pieces;
+    Bitset64 captures = attacks & pieces;
 
     /* Loop over all the moves generated */
     while (moves.any()) {
-      int target_square = countr_zero(moves.to_ulong());
-      moves.set(target_square, false);
-      moveList.push_back(
+      int target_square = moves.popLsb();
+      moveList->push(
           Move(source_square, target_square, QUIET_MOVE, piece_type, color));
     }
 
     /* Loop over all the captures generated */
     while (captures.any()) {
-      int target_square = countr_zero(captures.to_ulong());
-      captures.set(target_square, false);
-      moveList.push_back(
+      int target_square = captures.popLsb();
+      moveList->push(
           Move(source_square, target_square, CAPTURE, piece_type, color));
     }
+  }
+}
+
+void Bitboard::kingMoves(MoveList *moveList, Color color) {
+  Color opponent = (color == WHITE) ? BLACK : WHITE;
+  int king_square = kingSquare();
+
+  /* Remove the king from the occupancy so it cannot hide from a slider
+   * behind its own square */
+  Bitset64 occupancy = allPieces;
+  occupancy.set(king_square, false);
+
+  Bitset64 attacks = king_attacks[king_square];
+  Bitset64 pieces = (color == WHITE) ? allBlackPieces : allWhitePieces;
+
+  /* Loop over all the target squares */
+  while (attacks.any()) {
+    int target_square = attacks.popLsb();
+
+    if (allPieces.test(target_square) == true &&
+        pieces.test(target_square) == false) {
+      continue;
+    }
 
-    /* Pop the less significant bit */
-    bb.set(source_square, false);
+    if (isSquareAttacked(opponent, target_square, occupancy) == true) {
+      continue;
+    }
+
+    int flag = pieces.test(target_square) ? CAPTURE : QUIET_MOVE;
+    moveList->push(Move(king_square, target_square, flag, KING, color));
   }
 }
 
-void Bitboard::generateMoves() {
+bool Bitboard::isLegalEnPassant(int source_square, Color color) {
+  int captured_square = enPassantSq + ((color == WHITE) ? -8 : 8);
+
+  /* The capture must remove the checking pawn or block the check */
+  if (checkMask.test(enPassantSq) == false &&
+      checkMask.test(captured_square) == false) {
+    return false;
+  }
+
+  /* Both pawns leave their squares, which may expose the king to a slider
+   * along the rank or a diagonal */
+  Bitset64 occupancy = allPieces;
+  occupancy.set(source_square, false);
+  occupancy.set(captured_square, false);
+  occupancy.set(enPassantSq, true);
+
+  int offset = (color == WHITE) ? 1 : 0;
+  Bitset64 queens = piecesBB[WHITE_QUEENS_BB + offset];
+  Bitset64 bishopsAndQueens = piecesBB[WHITE_BISHOPS_BB + offset] | queens;
+  Bitset64 rooksAndQueens = piecesBB[WHITE_ROOKS_BB + offset] | queens;
+  int king_square = kingSquare();
+
+  return (bishop_attacks(lookupTable, king_square, occupancy) &
+          bishopsAndQueens)
+             .none() &&
+         (rook_attacks(lookupTable, king_square, occupancy) & rooksAndQueens)
+             .none();
+}
+
+void Bitboard::updateCheckInfo() {
+  int offset = (turn == WHITE) ? 1 : 0;
+  Bitset64 own_pieces = (turn == WHITE) ? allWhitePieces : allBlackPieces;
+  Bitset64 opponent_pieces = (turn == WHITE) ? allBlackPieces : allWhitePieces;
+
+  int king_square = kingSquare();
+
+  checkers = attacksToSquare(king_square, (turn == WHITE) ? BLACK : WHITE);
+
+  /* Evasions must capture the checker or block its ray, and nothing but
+   * the king can evade a double check */
+  if (checkers.none()) {
+    checkMask.set();
+  } else if (checkers.count() == 1) {
+    int checker_square = checkers.lsb();
+    checkMask = lookupTable->between[king_square][checker_square] | checkers;
+  } else {
+    checkMask.reset();
+  }
+
+  /* Opponent sliders that would attack the king through the own pieces */
+  Bitset64 queens = piecesBB[WHITE_QUEENS_BB + offset];
+  Bitset64 snipers =
+      (bishop_attacks(lookupTable, king_square, opponent_pieces) &
+       (piecesBB[WHITE_BISHOPS_BB + offset] | queens)) |
+      (rook_attacks(lookupTable, king_square, opponent_pieces) &
+       (piecesBB[WHITE_ROOKS_BB + offset] | queens));
+
+  /* A lone own piece between the king and a sniper is pinned */
+  pinned.reset();
+  while (snipers.any()) {
+    int sniper_square = snipers.popLsb();
+
+    Bitset64 blockers =
+        lookupTable->between[king_square][sniper_square] & allPieces;
+
+    if (blockers.count() == 1 && (blockers & own_pieces).any()) {
+      pinned |= blockers;
+    }
+  }
+}
+
+void Bitboard::generateMoves(MoveList *moveList) {
 
   /* Clear the move list */
-  moveList.clear();
+  moveList->clear();
+
+  updateCheckInfo();
+
+  /* Only the king can move out of a double check */
+  if (checkers.count() > 1) {
+    kingMoves(moveList, turn);
+    return;
+  }
 
   /* Loop over all the bitboards */
   int i = (turn == WHITE) ? 10 : 11;
   for (; i >= 0; i -= 2) {
 
     /* Get a copy of each piece bitboard */
-    bitset<64> bb = piecesBB[i];
+    Bitset64 bb = piecesBB[i];
 
     /* Generate moves for each piece */
     switch (i) {
     case WHITE_KING_BB:
-      pieceMoves(bb, WHITE, &Bitboard::generateKingAttacks, KING);
-      break;
     case BLACK_KING_BB:
-      pieceMoves(bb, BLACK, &Bitboard::generateKingAttacks, KING);
+      kingMoves(moveList, turn);
       break;
     case WHITE_QUEENS_BB:
-      pieceMoves(bb, WHITE, &Bitboard::generateQueenAttacks, QUEEN);
+      pieceMoves(moveList, bb, WHITE, &Bitboard::generateQueenAttacks, QUEEN);
       break;
     case BLACK_QUEENS_BB:
-      pieceMoves(bb, BLACK, &Bitboard::generateQueenAttacks, QUEEN);
+      pieceMoves(moveList, bb, BLACK, &Bitboard::generateQueenAttacks, QUEEN);
       break;
     case WHITE_ROOKS_BB:
-      pieceMoves(bb, WHITE, &Bitboard::generateRookAttacks, ROOK);
+      pieceMoves(moveList, bb, WHITE, &Bitboard::generateRookAttacks, ROOK);
       break;
     case BLACK_ROOKS_BB:
-      pieceMoves(bb, BLACK, &Bitboard::generateRookAttacks, ROOK);
+      pieceMoves(moveList, bb, BLACK, &Bitboard::generateRookAttacks, ROOK);
       break;
     case WHITE_BISHOPS_BB:
-      pieceMoves(bb, WHITE, &Bitboard::generateBishopAttacks, BISHOP);
+      pieceMoves(moveList, bb, WHITE, &Bitboard::generateBishopAttacks, BISHOP);
       break;
     case BLACK_BISHOPS_BB:
-      pieceMoves(bb, BLACK, &Bitboard::generateBishopAttacks, BISHOP);
+      pieceMoves(moveList, bb, BLACK, &Bitboard::generateBishopAttacks, BISHOP);
       break;
     case WHITE_KNIGHTS_BB:
-      pieceMoves(bb, WHITE, &Bitboard::generateKnightAttacks, KNIGHT);
+      pieceMoves(moveList, bb, WHITE, &Bitboard::generateKnightAttacks, KNIGHT);
       break;
     case BLACK_KNIGHTS_BB:
-      pieceMoves(bb, BLACK, &Bitboard::generateKnightAttacks, KNIGHT);
+      pieceMoves(moveList, bb, BLACK, &Bitboard::generateKnightAttacks, KNIGHT);
       break;
     case WHITE_PAWNS_BB:
-      pieceMoves(bb, WHITE, &Bitboard::generatePawnMoves,
+      pieceMoves(moveList, bb, WHITE, &Bitboard::generatePawnMoves,
                  &Bitboard::generatePawnAttacks);
       break;
     case BLACK_PAWNS_BB:
-      pieceMoves(bb, BLACK, &Bitboard::generatePawnMoves,
+      pieceMoves(moveList, bb, BLACK, &Bitboard::generatePawnMoves,
                  &Bitboard::generatePawnAttacks);
       break;
     default:
@@ -748,7 +637,7 @@ void Bitboard::generateMoves() {
     }
   }
 
-  generateCastleMoves(turn);
+  generateCastleMoves(moveList, turn);
 }
 
 Bitboard Bitboard::copyBoard() {
@@ -756,13 +645,70 @@ Bitboard Bitboard::copyBoard() {
   return bitboard_cpy;
 }
 
-bool Bitboard::makeMove(Move move) {
-  /* Save copy of the full bitboard */
-  Bitboard bitboard_cpy = copyBoard();
+void Bitboard::setAccumulators(AccumulatorStack *stack) {
+  accumulators = stack;
 
-  /* Reset en passant square */
-  enPassantSq = no_square;
+  if (accumulators != nullptr) {
+    accumulators->top = 0;
+  }
+}
+
+AccumulatorStack *Bitboard::getAccumulators() { return accumulators; }
+
+void Bitboard::pushAccumulator(const UndoInfo &undo) {
+#ifdef DEBUG
+  assert(accumulators->top + 1 < (int)accumulators->entries.size());
+#endif
+
+  Accumulator &acc = accumulators->entries[++accumulators->top];
+  DirtyPieces &dirty = acc.dirty;
+
+  int flag = undo.move.getFlag();
+  int source_square = undo.move.getSourceSquare();
+  int target_square = undo.move.getTargetSquare();
+  int color = undo.move.getColor();
+
+  auto add_dirty = [&](int piece, int from, int to) {
+    dirty.piece[dirty.count] = piece;
+    dirty.from[dirty.count] = from;
+    dirty.to[dirty.count] = to;
+    dirty.count++;
+  };
 
+  acc.computed = false;
+  dirty.count = 0;
+  dirty.turn = (color == WHITE) ? BLACK : WHITE;
+
+  /* A promoted pawn leaves the board and the promoted piece enters it */
+  int pieceBB = undo.move.getPiece() * 2 + (color == BLACK);
+
+  if (flag >= KNIGHT_PROMOTION) {
+    add_dirty(pieceBB, source_square, -1);
+    add_dirty(promotedPieceBB(flag, (Color)color), -1, target_square);
+  } else {
+    add_dirty(pieceBB, source_square, target_square);
+  }
+
+  if (undo.capturedPiece != EMPTY_SQUARE) {
+    int captured_square = target_square;
+    if (flag == EP_CAPTURE) {
+      captured_square += (color == WHITE) ? -8 : 8;
+    }
+
+    add_dirty(undo.capturedPiece, captured_square, -1);
+  }
+
+  int rooksBB = (color == WHITE) ? WHITE_ROOKS_BB : BLACK_ROOKS_BB;
+  int rank_x8 = (color == WHITE) ? 0 : 56;
+
+  if (flag == KING_CASTLE) {
+    add_dirty(rooksBB, rank_x8 + 7, rank_x8 + 5);
+  } else if (flag == QUEEN_CASTLE) {
+    add_dirty(rooksBB, rank_x8, rank_x8 + 3);
+  }
+}
+
+void Bitboard::makeMove(Move move, UndoInfo *undo) {
   /* Get the move type */
   int flag = move.getFlag();
   int source_square = move.getSourceSquare();
@@ -770,13 +716,25 @@ bool Bitboard::makeMove(Move move) {
   int piece = move.getPiece();
   int color = move.getColor();
 
+  /* Save the irreversible state of the position */
+  undo->move = move;
+  undo->capturedPiece = EMPTY_SQUARE;
+  undo->enPassantSq = enPassantSq;
+  undo->castlingRights = castlingRights;
+  undo->hash = hash;
+
+  /* Remove the previous en passant and castling keys and flip the side */
+  if (enPassantSq != no_square) {
+    hash ^= zobrist.enPassant[enPassantSq % 8];
+  }
+  hash ^= zobrist.castling[castlingRights] ^ zobrist.side;
+
+  /* Reset en passant square */
+  enPassantSq = no_square;
+
   /* Get the correct piece bitboard taking into account the color */
   int pieceBB = piece * 2 + (color == BLACK);
 
-  /* Remove piece from source square and add it to target square */
-  piecesBB[pieceBB].set(source_square, false);
-  piecesBB[pieceBB].set(target_square, true);
-
   /* Handle capture or promotion capture*/
   if (flag == CAPTURE || flag >= KNIGHT_PROMOTION_CAPTURE) {
     int i = (color == WHITE) ? 1 : 0;
@@ -785,115 +743,193 @@ bool Bitboard::makeMove(Move move) {
     for (; i < 12; i += 2) {
       if (piecesBB[i].test(target_square) == true) {
         piecesBB[i].set(target_square, false);
+        hash ^= zobrist.pieces[i][target_square];
+        undo->capturedPiece = i;
         break;
       }
     }
   }
 
+  /* Remove piece from source square and add it to target square */
+  piecesBB[pieceBB].set(source_square, false);
+  piecesBB[pieceBB].set(target_square, true);
+  hash ^= zobrist.pieces[pieceBB][source_square] ^
+          zobrist.pieces[pieceBB][target_square];
+
   /* Handle castling */
+  int rooksBB = (color == WHITE) ? WHITE_ROOKS_BB : BLACK_ROOKS_BB;
+  int rank_x8 = (color == WHITE) ? 0 : 56;
+
   if (flag == KING_CASTLE) {
-    if (color == WHITE) {
-      /* Move white rook */
-      piecesBB[WHITE_ROOKS_BB].set(7, false);
-      piecesBB[WHITE_ROOKS_BB].set(5, true);
-    } else {
-      /* Move black rook */
-      piecesBB[BLACK_ROOKS_BB].set(63, false);
-      piecesBB[BLACK_ROOKS_BB].set(61, true);
-    }
+    /* Move king side rook */
+    piecesBB[rooksBB].set(rank_x8 + 7, false);
+    piecesBB[rooksBB].set(rank_x8 + 5, true);
+    hash ^= zobrist.pieces[rooksBB][rank_x8 + 7] ^
+            zobrist.pieces[rooksBB][rank_x8 + 5];
   } else if (flag == QUEEN_CASTLE) {
-    if (color == WHITE) {
-      /* Move white rook */
-      piecesBB[WHITE_ROOKS_BB].set(0, false);
-      piecesBB[WHITE_ROOKS_BB].set(3, true);
-    } else {
-      /* Move black rook */
-      piecesBB[BLACK_ROOKS_BB].set(56, false);
-      piecesBB[BLACK_ROOKS_BB].set(59, true);
-    }
+    /* Move queen side rook */
+    piecesBB[rooksBB].set(rank_x8, false);
+    piecesBB[rooksBB].set(rank_x8 + 3, true);
+    hash ^= zobrist.pieces[rooksBB][rank_x8] ^
+            zobrist.pieces[rooksBB][rank_x8 + 3];
   }
 
   /* Handle promotion */
   if (flag >= KNIGHT_PROMOTION) {
+    int promotedBB = promotedPieceBB(flag, (Color)color);
+
     /* Delete the pawn */
     piecesBB[pieceBB].set(target_square, false);
 
-    /* Choose the promoted piece bitboard */
-    switch (flag) {
-    case QUEEN_PROMOTION:
-    case QUEEN_PROMOTION_CAPTURE:
-      pieceBB = (color == WHITE) ? WHITE_QUEENS_BB : BLACK_QUEENS_BB;
-      break;
-    case ROOK_PROMOTION:
-    case ROOK_PROMOTION_CAPTURE:
-      pieceBB = (color == WHITE) ? WHITE_ROOKS_BB : BLACK_ROOKS_BB;
-      break;
-    case KNIGHT_PROMOTION:
-    case KNIGHT_PROMOTION_CAPTURE:
-      pieceBB = (color == WHITE) ? WHITE_KNIGHTS_BB : BLACK_KNIGHTS_BB;
-      break;
-    case BISHOP_PROMOTION:
-    case BISHOP_PROMOTION_CAPTURE:
-      pieceBB = (color == WHITE) ? WHITE_BISHOPS_BB : BLACK_BISHOPS_BB;
-      break;
-    }
-
     /* Set promoted piece on piece bitboard */
-    piecesBB[pieceBB].set(target_square, true);
+    piecesBB[promotedBB].set(target_square, true);
+    hash ^= zobrist.pieces[pieceBB][target_square] ^
+            zobrist.pieces[promotedBB][target_square];
   }
 
   /* Handle double pawn push */
   if (flag == DOUBLE_PAWN_PUSH) {
     enPassantSq = target_square + ((color == WHITE) ? -8 : 8);
+    hash ^= zobrist.enPassant[enPassantSq % 8];
   }
 
   /* Handle en passant */
   if (flag == EP_CAPTURE) {
     int en_passant_capture_sq = target_square + ((color == WHITE) ? -8 : 8);
-    piecesBB[(color == WHITE) ? BLACK_PAWNS_BB : WHITE_PAWNS_BB].set(
-        en_passant_capture_sq, false);
+    undo->capturedPiece = (color == WHITE) ? BLACK_PAWNS_BB : WHITE_PAWNS_BB;
+    piecesBB[undo->capturedPiece].set(en_passant_capture_sq, false);
+    hash ^= zobrist.pieces[undo->capturedPiece][en_passant_capture_sq];
   }
 
   /* Update castling rights */
-  int king_side_index = (color == WHITE) ? 0 : 2;
-  int queen_side_index = king_side_index + 1;
-
   if (piece == KING) {
     /* Disable all castling rights */
-    castlingRights.set(king_side_index, false);
-    castlingRights.set(queen_side_index, false);
-  } else if (piece == ROOK) {
-    if (source_square == ((color == WHITE) ? 0 : 56)) {
-      /* Disable queen side castling */
-      castlingRights.set(queen_side_index, false);
-    } else if (source_square == ((color == WHITE) ? 7 : 63)) {
-      /* Disable king side castling */
-      castlingRights.set(king_side_index, false);
+    castlingRights &= (color == WHITE)
+                          ? ~(WHITE_KING_SIDE | WHITE_QUEEN_SIDE)
+                          : ~(BLACK_KING_SIDE | BLACK_QUEEN_SIDE);
+  }
+
+  /* A rook leaving or being captured on its corner loses its castling */
+  const int rook_corners[4] = {h1, a1, h8, a8};
+  for (int i = 0; i < 4; i++) {
+    if (source_square == rook_corners[i] || target_square == rook_corners[i]) {
+      castlingRights &= ~(1 << i);
     }
   }
 
-  /* Update all derived bitboards and sliding attacks */
-  updateDerivedBitboards();
-  slidingAttacks();
+  hash ^= zobrist.castling[castlingRights];
 
-  /* Check if the move is not legal (if the king is left on check after the
-   * move) */
-  if (isCheck((Color)color) == true) {
-    *this = bitboard_cpy;
-    return false;
+  if (accumulators != nullptr) {
+    pushAccumulator(*undo);
   }
 
-  moveHistory.push_back(move);
-
   /* Change turn */
   (turn == WHITE) ? turn = BLACK : turn = WHITE;
 
-  /* Generate moves for the new position */
-  generateMoves();
-  return true;
+  /* Update all derived bitboards */
+  updateDerivedBitboards();
+
+#ifdef DEBUG
+  assert(hash == computeHash());
+#endif
 }
 
-void Bitboard::unmakeMove() { return; }
+void Bitboard::unmakeMove(const UndoInfo &undo) {
+  if (accumulators != nullptr) {
+    accumulators->top--;
+  }
+
+  /* Get the move type */
+  int flag = undo.move.getFlag();
+  int source_square = undo.move.getSourceSquare();
+  int target_square = undo.move.getTargetSquare();
+  int piece = undo.move.getPiece();
+  int color = undo.move.getColor();
+
+  int pieceBB = piece * 2 + (color == BLACK);
+
+  /* Restore turn and irreversible state */
+  turn = (Color)color;
+  enPassantSq = undo.enPassantSq;
+  castlingRights = undo.castlingRights;
+  hash = undo.hash;
+
+  /* Move the piece back, demoting it first if it was a promotion */
+  if (flag >= KNIGHT_PROMOTION) {
+    piecesBB[promotedPieceBB(flag, (Color)color)].set(target_square, false);
+  } else {
+    piecesBB[pieceBB].set(target_square, false);
+  }
+  piecesBB[pieceBB].set(source_square, true);
+
+  /* Move the castled rook back */
+  int rooksBB = (color == WHITE) ? WHITE_ROOKS_BB : BLACK_ROOKS_BB;
+  int rank_x8 = (color == WHITE) ? 0 : 56;
+
+  if (flag == KING_CASTLE) {
+    piecesBB[rooksBB].set(rank_x8 + 5, false);
+    piecesBB[rooksBB].set(rank_x8 + 7, true);
+  } else if (flag == QUEEN_CASTLE) {
+    piecesBB[rooksBB].set(rank_x8 + 3, false);
+    piecesBB[rooksBB].set(rank_x8, true);
+  }
+
+  /* Put back the captured piece */
+  if (flag == EP_CAPTURE) {
+    piecesBB[undo.capturedPiece].set(
+        target_square + ((color == WHITE) ? -8 : 8), true);
+  } else if (undo.capturedPiece != EMPTY_SQUARE) {
+    piecesBB[undo.capturedPiece].set(target_square, true);
+  }
+
+  /* Update all derived bitboards */
+  updateDerivedBitboards();
+
+#ifdef DEBUG
+  assert(hash == computeHash());
+#endif
+}
+
+int Bitboard::promotedPieceBB(int flag, Color color) {
+  /* Choose the promoted piece bitboard */
+  switch (flag) {
+  case QUEEN_PROMOTION:
+  case QUEEN_PROMOTION_CAPTURE:
+    return (color == WHITE) ? WHITE_QUEENS_BB : BLACK_QUEENS_BB;
+  case ROOK_PROMOTION:
+  case ROOK_PROMOTION_CAPTURE:
+    return (color == WHITE) ? WHITE_ROOKS_BB : BLACK_ROOKS_BB;
+  case BISHOP_PROMOTION:
+  case BISHOP_PROMOTION_CAPTURE:
+    return (color == WHITE) ? WHITE_BISHOPS_BB : BLACK_BISHOPS_BB;
+  default:
+    return (color == WHITE) ? WHITE_KNIGHTS_BB : BLACK_KNIGHTS_BB;
+  }
+}
+
+uint64_t Bitboard::computeHash() {
+  uint64_t key = 0;
+
+  for (int i = 0; i < 12; i++) {
+    Bitset64 bb = piecesBB[i];
+
+    while (bb.any()) {
+      key ^= zobrist.pieces[i][bb.popLsb()];
+    }
+  }
+
+  if (enPassantSq != no_square) {
+    key ^= zobrist.enPassant[enPassantSq % 8];
+  }
+
+  key ^= zobrist.castling[castlingRights];
+
+  if (turn == BLACK) {
+    key ^= zobrist.side;
+  }
+
+  return key;
+}
 
 void Bitboard::updateDerivedBitboards() {
   allWhitePieces = (piecesBB[WHITE_KING_BB] | piecesBB[WHITE_QUEENS_BB] |
@@ -905,17 +941,18 @@ void Bitboard::updateDerivedBitboards() {
                     piecesBB[BLACK_ROOKS_BB] | piecesBB[BLACK_PAWNS_BB]);
 
   allPieces = (allWhitePieces | allBlackPieces);
-
-  emptySquares = ~allPieces;
 }
 
 void Bitboard::printMoveList() {
-  for (Move m : moveList) {
+  MoveList move_list;
+  generateMoves(&move_list);
+
+  for (Move m : move_list) {
     m.prettyPrintMove();
   }
 }
 
-void Bitboard::printBitboard(bitset<64> bitboard) {
+void Bitboard::printBitboard(Bitset64 bitboard) {
   int i, j;
   char c = 'a';
 
@@ -959,7 +996,7 @@ void Bitboard::printBoard() {
       int piece = -1;
 
       for (z = 0; z < 12; z++) {
-        bitset<64> pieces = piecesBB[z];
+        Bitset64 pieces = piecesBB[z];
         if ((pieces & lookupTable->piece_lookup[square]).any() == true) {
           piece = z;
           break;
@@ -984,19 +1021,19 @@ void Bitboard::printBoard() {
   cout << endl << endl;
 
   cout << "Castling rights: ";
-  if (castlingRights.test(0) == true) {
+  if (castlingRights & WHITE_KING_SIDE) {
     cout << "K";
   }
-  if (castlingRights.test(1) == true) {
+  if (castlingRights & WHITE_QUEEN_SIDE) {
     cout << "Q";
   }
-  if (castlingRights.test(2) == true) {
+  if (castlingRights & BLACK_KING_SIDE) {
     cout << "k";
   }
-  if (castlingRights.test(3) == true) {
+  if (castlingRights & BLACK_QUEEN_SIDE) {
     cout << "q";
   }
-  if (castlingRights.any() == false) {
+  if (castlingRights == 0) {
     cout << "-";
   }
   cout << endl << endl;
@@ -1,18 +1,31 @@
+#include "../includes/bench.h"
 #include "../includes/bitboard.h"
+#include "../includes/eval_cache.h"
+#include "../includes/fen.h"
 #include "../includes/lookup_table.h"
 #include "../includes/model.h"
 #include "../includes/move.h"
+#include "../includes/perft.h"
+#include "../includes/search.h"
+#include "../includes/transposition_table.h"
 #include "../includes/utils.h"
 #include <algorithm>
 #include <array>
 #include <bitset>
 #include <cctype>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <endian.h>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <new>
 #include <onnxruntime/onnxruntime_cxx_api.h>
+#include <sstream>
 #include <string>
+#include <syncstream>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -23,107 +36,26 @@
   "r1bqkbnr/pppp1ppp/2n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R b KQkq -"
 #define SCANDI "rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq d6"
 
-#define DEPTH 3
+/* Time in ms the engine thinks its moves in the play protocol */
+#define ENGINE_MOVE_TIME 1000
 
-Bitboard parse_fen(LookupTable *lut, string fen_str) {
-  bitset<64> pieces[12];
-  long unsigned int str_counter = 0;
-
-  for (int i = RANKS - 1; i >= 0; --i) {
-    for (int j = 0; j < FILES && str_counter < fen_str.length();
-         ++j, ++str_counter) {
-      char c = fen_str[str_counter];
-      if (isdigit(c)) {
-        j += (c - '1');
-      } else {
-        switch (c) {
-        case 'P':
-          pieces[0].set(i * 8 + j);
-          break;
-        case 'p':
-          pieces[1].set(i * 8 + j);
-          break;
-        case 'R':
-          pieces[2].set(i * 8 + j);
-          break;
-        case 'r':
-          pieces[3].set(i * 8 + j);
-          break;
-        case 'N':
-          pieces[4].set(i * 8 + j);
-          break;
-        case 'n':
-          pieces[5].set(i * 8 + j);
-          break;
-        case 'B':
-          pieces[6].set(i * 8 + j);
-          break;
-        case 'b':
-          pieces[7].set(i * 8 + j);
-          break;
-        case 'Q':
-          pieces[8].set(i * 8 + j);
-          break;
-        case 'q':
-          pieces[9].set(i * 8 + j);
-          break;
-        case 'K':
-          pieces[10].set(i * 8 + j);
-          break;
-        case 'k':
-          pieces[11].set(i * 8 + j);
-          break;
-        case '/':
-          --j;
-          break;
-        }
-      }
-    }
-  }
-
-  str_counter = fen_str.find(" ", str_counter);
-  Color turn = (fen_str[++str_counter] == 'w') ? WHITE : BLACK;
-
-  bitset<4> castling_rights;
-  str_counter += 2;
-  while (fen_str[str_counter] != ' ' && fen_str[str_counter] != '\0') {
-    switch (fen_str[str_counter]) {
-    case 'K':
-      castling_rights.set(0);
-      break;
-    case 'Q':
-      castling_rights.set(1);
-      break;
-    case 'k':
-      castling_rights.set(2);
-      break;
-    case 'q':
-      castling_rights.set(3);
-      break;
-    }
-    ++str_counter;
-  }
-
-  ++str_counter;
-  string en_passant = "";
-  while (fen_str[str_counter] != ' ' && fen_str[str_counter] != '\0') {
-    en_passant.push_back(fen_str[str_counter]);
-    ++str_counter;
-  }
-
-  int en_passant_sq = no_square;
-  if (en_passant != " " && en_passant != "-") {
-    en_passant_sq = squareToCoordinate.at(en_passant);
-  }
-
-  return Bitboard(lut, pieces, castling_rights, en_passant_sq, turn);
-}
+/* UCI options that are not owned by another object */
+typedef struct {
+  int threads;
+  int evalBatch;
+  EvalBackend evalBackend;
+  OnnxConfig onnx;
+} UciOptions;
 
 /* UCI move parser */
 int uci_parse_move(string uci_move_str, Bitboard *bb) {
   string source_square_str, target_square_str;
   char promotion;
 
+  if (uci_move_str.length() != 4 && uci_move_str.length() != 5) {
+    return -1;
+  }
+
   source_square_str.push_back(uci_move_str[0]);
   source_square_str.push_back(uci_move_str[1]);
 
@@ -136,10 +68,19 @@ int uci_parse_move(string uci_move_str, Bitboard *bb) {
     promotion = uci_move_str[4];
   }
 
-  unsigned int source_square = squareToCoordinate.at(source_square_str);
-  unsigned int target_square = squareToCoordinate.at(target_square_str);
+  auto source_it = squareToCoordinate.find(source_square_str);
+  auto target_it = squareToCoordinate.find(target_square_str);
 
-  vector<Move> move_list = bb->getMoveList();
+  if (source_it == squareToCoordinate.end() ||
+      target_it == squareToCoordinate.end()) {
+    return -1;
+  }
+
+  int source_square = source_it->second;
+  int target_square = target_it->second;
+
+  MoveList move_list;
+  bb->generateMoves(&move_list);
 
   Move move_found;
   bool found = false;
@@ -156,8 +97,8 @@ int uci_parse_move(string uci_move_str, Bitboard *bb) {
 
       int flag = move.getFlag();
 
-      bool capture_flag = (target_square == source_square - 8 ||
-                           target_square == source_square + 8);
+      /* A pawn only changes file when it captures */
+      bool capture_flag = (source_square % 8 != target_square % 8);
 
       // If statement probably more efficient and readable
       switch (promotion) {
@@ -205,11 +146,9 @@ int uci_parse_move(string uci_move_str, Bitboard *bb) {
     return -1;
   }
 
-  bool legal = bb->makeMove(move_found);
-
-  if (legal == false) {
-    return -1;
-  }
+  /* The game is never taken back, so the undo record is dropped */
+  UndoInfo undo;
+  bb->makeMove(move_found, &undo);
 
   if (bb->isCheckmate(bb->getTurn())) {
     return bb->getTurn();
@@ -242,10 +181,11 @@ void uci_parse_position(string uci_pos_str, Bitboard *bb, LookupTable *lut) {
     return;
   }
 
-  uci_pos_str.erase(0, moves_pos + 6);
+  /* Moves are separated by spaces, and promotions take 5 characters */
+  istringstream moves(uci_pos_str.substr(moves_pos + 5));
+  string uci_move_str;
 
-  for (size_t i = 0; i + 1 < uci_pos_str.size(); i += 3) {
-    string uci_move_str = uci_pos_str.substr(i, 4);
+  while (moves >> uci_move_str) {
     cout << uci_move_str << endl;
 
     int res = uci_parse_move(uci_move_str, bb);
@@ -253,116 +193,154 @@ void uci_parse_position(string uci_pos_str, Bitboard *bb, LookupTable *lut) {
     if (res != 0) {
       break;
     }
-
-    i += 2;
   }
 }
 
-pair<double, Move> alphabeta(Bitboard *bb, int ply, double a, double b,
-                             ChessNN &nn) {
-  if (ply == 0) {
-    auto pieces_bb = bb->getPieces();
-    int turn = bb->getTurn();
-
-    float eval = nn.predict(pieces_bb, turn);
-
-    return {static_cast<double>(eval), Move()};
+/* UCI go parser */
+SearchLimits uci_parse_go(string uci_go_str) {
+  SearchLimits limits = init_search_limits();
+  istringstream tokens(uci_go_str.substr(2));
+  string token;
+
+  while (tokens >> token) {
+    if (token == "wtime") {
+      tokens >> limits.time[WHITE];
+    } else if (token == "btime") {
+      tokens >> limits.time[BLACK];
+    } else if (token == "winc") {
+      tokens >> limits.inc[WHITE];
+    } else if (token == "binc") {
+      tokens >> limits.inc[BLACK];
+    } else if (token == "movestogo") {
+      tokens >> limits.movesToGo;
+    } else if (token == "movetime") {
+      tokens >> limits.moveTime;
+    } else if (token == "depth") {
+      tokens >> limits.depth;
+    } else if (token == "nodes") {
+      tokens >> limits.nodes;
+    } else if (token == "infinite") {
+      limits.infinite = true;
+    } else if (token == "ponder") {
+      limits.ponder = true;
+    } else if (isdigit(token[0])) {
+      /* Plain "go <depth>" */
+      limits.depth = stoi(token);
+    }
   }
 
-  vector<Move> moves = bb->getMoveList();
-  Move best_move = Move();
-
-  if (bb->getTurn() == WHITE) {
-    double value = -numeric_limits<double>::infinity();
-
-    for (Move move : moves) {
-      Bitboard bb_cpy = bb->copyBoard();
-
-      bool legal = bb->makeMove(move);
-
-      if (legal == false)
-        continue;
+  return limits;
+}
 
-      auto [child_value, _] = alphabeta(bb, ply - 1, a, b, nn);
+void engine_move(Bitboard *bb, ChessNN &nn, TranspositionTable &tt,
+                 EvalCache &cache) {
+  SearchLimits limits = init_search_limits();
+  limits.moveTime = ENGINE_MOVE_TIME;
 
-      if (child_value > value) {
-        value = child_value;
-        best_move = move;
-      }
+  SearchSignals signals;
+  signals.stop = false;
+  signals.ponder = false;
+  signals.nodes = 0;
 
-      *bb = bb_cpy;
+  Move move = search(bb, limits, nn, tt, cache, &signals, DEFAULT_THREADS);
 
-      if (value >= b)
-        break;
-
-      a = max(a, value);
-    }
+  if (move == Move()) {
+    return;
+  }
 
-    return {value, best_move};
-  } else {
-    double value = numeric_limits<double>::infinity();
+  UndoInfo undo;
+  bb->makeMove(move, &undo);
+}
 
-    for (Move move : moves) {
-      Bitboard bb_cpy = bb->copyBoard();
+void send_pos(Bitboard *bb) {
+  array<int, 64> pieces = bb->getPiecesAtSquares();
 
-      bool legal = bb->makeMove(move);
+  cout << "pos ";
+  for (int i = 0; i < 64; i++) {
+    cout << pieces[i] << "-";
+  }
 
-      if (legal == false)
-        continue;
+  // cout << bb->getTurn();
 
-      auto [child_value, _] = alphabeta(bb, ply - 1, a, b, nn);
+  cout << endl;
+}
 
-      if (child_value < value) {
-        value = child_value;
-        best_move = move;
-      }
+/* UCI setoption parser */
+void uci_parse_setoption(string uci_option_str, TranspositionTable &tt,
+                         EvalCache &cache, UciOptions *options) {
+  auto name_pos = uci_option_str.find("name ");
+  auto value_pos = uci_option_str.find(" value ");
 
-      *bb = bb_cpy;
+  if (name_pos == uci_option_str.npos || value_pos == uci_option_str.npos) {
+    cout << "Bad UCI setoption command" << endl;
+    return;
+  }
 
-      if (value <= a)
-        break;
+  string name = uci_option_str.substr(name_pos + 5, value_pos - name_pos - 5);
+  string value = uci_option_str.substr(value_pos + 7);
 
-      b = min(b, value);
+  if (name == "Hash") {
+    int mb = clamp(stoi(value), MIN_HASH_MB, MAX_HASH_MB);
+    try {
+      tt.resize(mb);
+    } catch (const bad_alloc &e) {
+      cout << "info string Hash " << mb
+           << " MB could not be allocated, keeping the previous size" << endl;
     }
-
-    return {value, best_move};
+  } else if (name == "EvalCache") {
+    int mb = clamp(stoi(value), 0, MAX_EVAL_CACHE_MB);
+    try {
+      cache.resize(mb);
+    } catch (const bad_alloc &e) {
+      cout << "info string EvalCache " << mb
+           << " MB could not be allocated, keeping the previous size" << endl;
+    }
+  } else if (name == "Threads") {
+    options->threads = clamp(stoi(value), 1, MAX_THREADS);
+  } else if (name == "EvalBatch") {
+    options->evalBatch = clamp(stoi(value), 1, NN_MAX_BATCH);
+  } else if (name == "EvalBackend") {
+    auto found =
+        find(begin(eval_backend_names), end(eval_backend_names), value);
+    if (found == end(eval_backend_names)) {
+      cout << "Unknown EvalBackend " << value << endl;
+      return;
+    }
+    options->evalBackend = (EvalBackend)(found - begin(eval_backend_names));
+  } else if (name == "OnnxIntraThreads") {
+    options->onnx.intraOpThreads = clamp(stoi(value), 0, MAX_THREADS);
+  } else if (name == "OnnxInterThreads") {
+    options->onnx.interOpThreads = clamp(stoi(value), 0, MAX_THREADS);
+  } else if (name == "OnnxOptimization") {
+    auto found = find(begin(onnx_optimization_names),
+                      end(onnx_optimization_names), value);
+    if (found == end(onnx_optimization_names)) {
+      cout << "Unknown OnnxOptimization " << value << endl;
+      return;
+    }
+    options->onnx.optimizationLevel =
+        onnx_optimization_levels[found - begin(onnx_optimization_names)];
+  } else if (name == "OnnxOptimizedModel") {
+    options->onnx.optimizedModelPath = (value == "<empty>") ? "" : value;
+  } else if (name == "Ponder") {
+    /* Nothing to set up, the GUI decides when to ponder */
+  } else {
+    cout << "Unknown UCI option " << name << endl;
   }
 }
 
-/* UCI go parser */
-void uci_parse_go(string uci_go_str, Bitboard *bb, ChessNN &nn) {
-  uci_go_str.erase(0, 2);
-
-  int depth = stoi(uci_go_str);
-  auto [val, move] = alphabeta(bb, depth, -numeric_limits<double>::infinity(),
-                               numeric_limits<double>::infinity(), nn);
-
-  cout << "Best move for "
-       << ((bb->getTurn() == WHITE) ? "white: " : "black: ");
-
-  move.prettyPrintMove();
-
-  cout << "alphabeta eval: " << val << endl;
-}
-
-void engine_move(Bitboard *bb, ChessNN &nn) {
-  auto [_, move] = alphabeta(bb, DEPTH, -numeric_limits<double>::infinity(),
-                             numeric_limits<double>::infinity(), nn);
+/* Sets the backend of the network, keeping the one in use if unavailable.
+ * The evaluations cached by another backend are discarded */
+void set_eval_backend(ChessNN &nn, EvalCache &cache, EvalBackend backend) {
+  cache.clear();
 
-  bb->makeMove(move);
-}
-
-void send_pos(Bitboard *bb) {
-  array<int, 64> pieces = bb->getPiecesAtSquares();
-
-  cout << "pos ";
-  for (int i = 0; i < 64; i++) {
-    cout << pieces[i] << "-";
+  if (nn.setBackend(backend) == false) {
+    cout << "info string EvalBackend " << eval_backend_names[backend]
+         << " not available" << endl;
   }
 
-  // cout << bb->getTurn();
-
-  cout << endl;
+  cout << "info string EvalBackend " << eval_backend_names[nn.getBackend()]
+       << endl;
 }
 
 void uci_loop() {
@@ -372,29 +350,78 @@ void uci_loop() {
   cout << "id name Santachess 0.1" << endl;
   cout << "id author Carlos GS" << endl;
 
+  // Print engine options
+  cout << "option name Hash type spin default " << DEFAULT_HASH_MB << " min "
+       << MIN_HASH_MB << " max " << MAX_HASH_MB << endl;
+  cout << "option name Threads type spin default " << DEFAULT_THREADS
+       << " min 1 max " << MAX_THREADS << endl;
+  cout << "option name EvalCache type spin default " << DEFAULT_EVAL_CACHE_MB
+       << " min 0 max " << MAX_EVAL_CACHE_MB << endl;
+  cout << "option name Ponder type check default false" << endl;
+  cout << "option name EvalBatch type spin default " << NN_DEFAULT_BATCH
+       << " min 1 max " << NN_MAX_BATCH << endl;
+  cout << "option name EvalBackend type combo default "
+       << eval_backend_names[BACKEND_AUTO];
+  for (const char *backend : eval_backend_names) {
+    cout << " var " << backend;
+  }
+  cout << endl;
+  cout << "option name OnnxIntraThreads type spin default "
+       << NN_DEFAULT_INTRA_THREADS << " min 0 max " << MAX_THREADS << endl;
+  cout << "option name OnnxInterThreads type spin default "
+       << NN_DEFAULT_INTER_THREADS << " min 0 max " << MAX_THREADS << endl;
+  cout << "option name OnnxOptimization type combo default all";
+  for (const char *level : onnx_optimization_names) {
+    cout << " var " << level;
+  }
+  cout << endl;
+  cout << "option name OnnxOptimizedModel type string default <empty>"
+       << endl;
+
   // uciok - engine ready
   cout << "uciok" << endl;
 
-  // wait for isready command
+  TranspositionTable tt(DEFAULT_HASH_MB);
+  EvalCache cache(DEFAULT_EVAL_CACHE_MB);
+  UciOptions options;
+  options.threads = DEFAULT_THREADS;
+  options.evalBatch = NN_DEFAULT_BATCH;
+  options.evalBackend = BACKEND_AUTO;
+  options.onnx = init_onnx_config();
+
+  // wait for isready command, options are set before it
   do {
     getline(cin, uci_command);
+
+    if (uci_command.rfind("setoption", 0) == 0) {
+      uci_parse_setoption(uci_command, tt, cache, &options);
+    }
   } while (uci_command != "isready");
 
   // Init everything
   LookupTable *lut = init_lookup_table();
   Bitboard bb = Bitboard(lut);
 
-  ChessNN nn("chess.onnx");
+  ChessNN nn("chess.onnx", options.onnx);
+  nn.setBatchSize(options.evalBatch);
+  set_eval_backend(nn, cache, options.evalBackend);
+
+  // searches run on their own thread, destroyed before nn, tt and cache
+  SearchThread search_thread;
 
   // send readyok after receiving isready
   cout << "readyok" << endl;
 
   send_pos(&bb);
-  // Get commands from stdin
-  while (1) {
+  // Get commands from stdin, the end of the input quits
+  while (getline(cin, uci_command)) {
     // bb.printBoard();
 
-    getline(cin, uci_command);
+    // The position and the options are never changed under a search
+    if (uci_command.rfind("go", 0) != 0 && uci_command != "stop" &&
+        uci_command != "ponderhit" && uci_command != "isready") {
+      search_thread.stop();
+    }
 
     if (uci_command.rfind("position", 0) == 0) {
       uci_parse_position(uci_command, &bb, lut);
@@ -412,8 +439,29 @@ void uci_loop() {
       } else {
         send_pos(&bb);
       }
+    } else if (uci_command.rfind("setoption", 0) == 0) {
+      uci_parse_setoption(uci_command, tt, cache, &options);
+      nn.setBatchSize(options.evalBatch);
+
+      if (uci_command.find("name EvalBackend ") != uci_command.npos) {
+        set_eval_backend(nn, cache, options.evalBackend);
+      } else if (uci_command.find("name Onnx") != uci_command.npos &&
+                 nn.setOnnxConfig(options.onnx) == false) {
+        cout << "info string ONNX Runtime session cannot be created, "
+             << "settings not changed" << endl;
+        options.onnx = nn.getOnnxConfig();
+      }
     } else if (uci_command.rfind("go", 0) == 0) {
-      uci_parse_go(uci_command, &bb, nn);
+      search_thread.start(bb, uci_parse_go(uci_command), nn, tt, cache,
+                          options.threads);
+    } else if (uci_command == "stop") {
+      search_thread.stop();
+    } else if (uci_command == "ponderhit") {
+      search_thread.ponderhit();
+    } else if (uci_command == "isready") {
+      osyncstream(cout) << "readyok" << endl;
+    } else if (uci_command == "ucinewgame") {
+      tt.clear();
     } else if (uci_command == "quit") {
       break;
     } else {
@@ -438,6 +486,8 @@ void game_loop() {
   Bitboard bb = Bitboard(lut);
 
   ChessNN nn("chess.onnx");
+  TranspositionTable tt(DEFAULT_HASH_MB);
+  EvalCache cache(DEFAULT_EVAL_CACHE_MB);
 
   // send readyok after receiving isready
   cout << "readyok" << endl;
@@ -459,7 +509,7 @@ void game_loop() {
         send_pos(&bb);
       }
 
-      engine_move(&bb, nn);
+      engine_move(&bb, nn, tt, cache);
       send_pos(&bb);
 
     } else if (game_command == "quit") {
@@ -473,27 +523,44 @@ void game_loop() {
   return;
 }
 
-/* Performance test function */
-int perft(Bitboard bitboard, int depth) {
-  /* Base case */
-  if (depth == 0) {
-    return 1;
+int main(int argc, char *argv[]) {
+  string command;
+
+  /* Threads of the perft, all the cores unless --threads is given, and
+   * size in MB of its cache, none unless --hash is given */
+  int threads = max((int)thread::hardware_concurrency(), 1);
+  int hash_mb = 0;
+
+  /* EPD perft suite and deepest count checked, run without reading any
+   * command */
+  string epd_path;
+  int epd_depth = 0;
+
+  for (int i = 1; i + 1 < argc; i++) {
+    if (string(argv[i]) == "--threads") {
+      threads = max(stoi(argv[i + 1]), 1);
+    } else if (string(argv[i]) == "--hash") {
+      hash_mb = max(stoi(argv[i + 1]), 0);
+    } else if (string(argv[i]) == "--epd") {
+      epd_path = argv[i + 1];
+    } else if (string(argv[i]) == "--depth") {
+      epd_depth = max(stoi(argv[i + 1]), 0);
+    }
   }
 
-  /* General case */
-  int nodes = 0;
-  for (Move m : bitboard.getMoveList()) {
-    Bitboard bb_cpy = bitboard.copyBoard();
-    if (bitboard.makeMove(m) == true)
-      nodes += perft(bitboard, depth - 1);
-    bitboard = bb_cpy;
+  unique_ptr<PerftCache> cache;
+  if (hash_mb > 0) {
+    cache = make_unique<PerftCache>(hash_mb);
   }
 
-  return nodes;
-}
+  if (epd_path != "") {
+    LookupTable *lut = init_lookup_table();
+    int failed =
+        run_perft_suite(lut, epd_path, epd_depth, threads, cache.get());
 
-int main() {
-  string command;
+    free(lut);
+    return (failed == 0) ? 0 : 1;
+  }
 
   getline(cin, command);
 
@@ -501,7 +568,7 @@ int main() {
     uci_loop();
   } else if (command == "play") {
     game_loop();
-  } else if (command == "perft") {
+  } else if (command == "perft" || command == "divide") {
     // TO-DO use bb parsed from fen string
     LookupTable *lut = init_lookup_table();
     Bitboard perft_bb = Bitboard(lut);
@@ -524,7 +591,40 @@ int main() {
 
     int depth = stoi(depth_str);
 
-    cout << "performance test nodes: " << perft(perft_bb, depth) << endl;
+    auto start = chrono::steady_clock::now();
+    uint64_t nodes;
+
+    /* divide also prints the nodes under every root move */
+    if (command == "divide" && depth > 0) {
+      nodes = divide(perft_bb, depth, threads, cache.get());
+    } else {
+      nodes = parallel_perft(perft_bb, depth, threads, cache.get());
+    }
+
+    auto elapsed = chrono::steady_clock::now() - start;
+
+    int64_t ms = chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+
+    cout << "performance test nodes: " << nodes << endl;
+    cout << "time: " << ms << " ms, threads: " << threads
+         << ", nodes/sec: " << nodes * 1000 / max(ms, (int64_t)1) << endl;
+  } else if (command.rfind("bench", 0) == 0) {
+    /* bench [depth] [threads] [hash] */
+    int bench_depth = BENCH_DEPTH;
+    int bench_threads = BENCH_THREADS;
+    int bench_hash_mb = BENCH_HASH_MB;
+
+    istringstream args(command.substr(5));
+    args >> bench_depth >> bench_threads >> bench_hash_mb;
+
+    LookupTable *lut = init_lookup_table();
+    ChessNN nn("chess.onnx");
+
+    bench(lut, nn, clamp(bench_depth, 1, MAX_DEPTH),
+          clamp(bench_threads, 1, MAX_THREADS),
+          clamp(bench_hash_mb, MIN_HASH_MB, MAX_HASH_MB));
+
+    free(lut);
   } else {
     cout << "engine cannot parse command" << endl;
     return -1;
@@ -0,0 +1,57 @@
+#include "../includes/eval_cache.h"
+
+/* The score is stored in the lower 16 bits and the key in the rest */
+#define SCORE_MASK 0xFFFFULL
+
+EvalCache::EvalCache(size_t mb) : entries(nullptr), entryCount(0) {
+  resize(mb);
+}
+
+EvalCache::~EvalCache() { delete[] entries; }
+
+void EvalCache::resize(size_t mb) {
+  /* Allocate before releasing so a failure leaves the current cache */
+  size_t count = mb * 1024 * 1024 / sizeof(atomic<uint64_t>);
+  atomic<uint64_t> *resized = nullptr;
+  if (count > 0) {
+    resized = new atomic<uint64_t>[count];
+  }
+
+  delete[] entries;
+  entries = resized;
+  entryCount = count;
+
+  clear();
+}
+
+void EvalCache::clear() {
+  for (size_t i = 0; i < entryCount; i++) {
+    entries[i].store(0, memory_order_relaxed);
+  }
+}
+
+bool EvalCache::probe(uint64_t key, int *score) {
+  if (entryCount == 0) {
+    return false;
+  }
+
+  uint64_t data = entry(key).load(memory_order_relaxed);
+
+  /* An empty entry is 0, so a position whose upper key bits and score are
+   * all 0 is never found */
+  if (data == 0 || ((data ^ key) & ~SCORE_MASK) != 0) {
+    return false;
+  }
+
+  *score = (int16_t)(data & SCORE_MASK);
+  return true;
+}
+
+void EvalCache::store(uint64_t key, int score) {
+  if (entryCount == 0) {
+    return;
+  }
+
+  entry(key).store((key & ~SCORE_MASK) | (uint16_t)score,
+                   memory_order_relaxed);
+}
@@ -0,0 +1,96 @@
+#include "../includes/fen.h"
+#include <cctype>
+
+Bitboard parse_fen(LookupTable *lut, string fen_str) {
+  Bitset64 pieces[12];
+  long unsigned int str_counter = 0;
+
+  for (int i = RANKS - 1; i >= 0; --i) {
+    for (int j = 0; j < FILES && str_counter < fen_str.length();
+         ++j, ++str_counter) {
+      char c = fen_str[str_counter];
+      if (isdigit(c)) {
+        j += (c - '1');
+      } else {
+        switch (c) {
+        case 'P':
+          pieces[0].set(i * 8 + j);
+          break;
+        case 'p':
+          pieces[1].set(i * 8 + j);
+          break;
+        case 'R':
+          pieces[6].set(i * 8 + j);
+          break;
+        case 'r':
+          pieces[7].set(i * 8 + j);
+          break;
+        case 'N':
+          pieces[2].set(i * 8 + j);
+          break;
+        case 'n':
+          pieces[3].set(i * 8 + j);
+          break;
+        case 'B':
+          pieces[4].set(i * 8 + j);
+          break;
+        case 'b':
+          pieces[5].set(i * 8 + j);
+          break;
+        case 'Q':
+          pieces[8].set(i * 8 + j);
+          break;
+        case 'q':
+          pieces[9].set(i * 8 + j);
+          break;
+        case 'K':
+          pieces[10].set(i * 8 + j);
+          break;
+        case 'k':
+          pieces[11].set(i * 8 + j);
+          break;
+        case '/':
+          --j;
+          break;
+        }
+      }
+    }
+  }
+
+  str_counter = fen_str.find(" ", str_counter);
+  Color turn = (fen_str[++str_counter] == 'w') ? WHITE : BLACK;
+
+  uint8_t castling_rights = 0;
+  str_counter += 2;
+  while (fen_str[str_counter] != ' ' && fen_str[str_counter] != '\0') {
+    switch (fen_str[str_counter]) {
+    case 'K':
+      castling_rights |= WHITE_KING_SIDE;
+      break;
+    case 'Q':
+      castling_rights |= WHITE_QUEEN_SIDE;
+      break;
+    case 'k':
+      castling_rights |= BLACK_KING_SIDE;
+      break;
+    case 'q':
+      castling_rights |= BLACK_QUEEN_SIDE;
+      break;
+    }
+    ++str_counter;
+  }
+
+  ++str_counter;
+  string en_passant = "";
+  while (fen_str[str_counter] != ' ' && fen_str[str_counter] != '\0') {
+    en_passant.push_back(fen_str[str_counter]);
+    ++str_counter;
+  }
+
+  int en_passant_sq = no_square;
+  if (en_passant != " " && en_passant != "-") {
+    en_passant_sq = squareToCoordinate.at(en_passant);
+  }
+
+  return Bitboard(lut, pieces, castling_rights, en_passant_sq, turn);
+}
@@ -1,5 +1,5 @@
 #include "../includes/lookup_table.h"
-#include <bitset>
+#include <bit>
 #include <cstdio>
 #include <cstdlib>
 
@@ -7,10 +7,12 @@
 #define H_FILE 0x8080808080808080;
 #define FIRST_RANK 0x00000000000000FF;
 #define EIGHTH_RANK 0xFF00000000000000;
-#define MAIN_DIAGONAL 0x8040201008040201;
-#define MAIN_ANTIDIAGONAL 0x0102040810204080;
 
-void init_diagonals(LookupTable *lut);
+/* Rank and file steps of the sliding pieces rays */
+const int bishop_directions[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+const int rook_directions[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+void init_sliding_masks(LookupTable *lut);
 
 void init_files(LookupTable *lut);
 
@@ -18,9 +20,13 @@ void init_ranks(LookupTable *lut);
 
 void init_squares(LookupTable *lut);
 
-int generate_rank_attack(int o, int f);
+Bitset64 generate_sliding_attack(const int directions[4][2], int square,
+                                 Bitset64 occupancy);
+
+void init_magics(Magic magics[SQUARES], Bitset64 *table,
+                 const int directions[4][2]);
 
-void init_first_rank_attacks(LookupTable *lut);
+void init_lines(LookupTable *lut);
 
 LookupTable *init_lookup_table() {
   LookupTable *lookup_table = NULL;
@@ -35,9 +41,15 @@ LookupTable *init_lookup_table() {
 
   init_ranks(lookup_table);
 
-  init_diagonals(lookup_table);
+  init_sliding_masks(lookup_table);
+
+  init_magics(lookup_table->bishop_magics, lookup_table->bishop_attacks,
+              bishop_directions);
+
+  init_magics(lookup_table->rook_magics, lookup_table->rook_attacks,
+              rook_directions);
 
-  init_first_rank_attacks(lookup_table);
+  init_lines(lookup_table);
 
   return lookup_table;
 }
@@ -52,7 +64,7 @@ void init_squares(LookupTable *lut) {
 void init_files(LookupTable *lut) {
   int i;
 
-  bitset<64> file = A_FILE;
+  Bitset64 file = A_FILE;
 
   for (i = 0; i < FILES; i++) {
     lut->mask_file[i] = file;
@@ -64,7 +76,7 @@ void init_files(LookupTable *lut) {
 void init_ranks(LookupTable *lut) {
   int i;
 
-  bitset<64> rank = FIRST_RANK;
+  Bitset64 rank = FIRST_RANK;
 
   for (i = 0; i < RANKS; i++) {
     lut->mask_rank[i] = rank;
@@ -73,67 +85,135 @@ void init_ranks(LookupTable *lut) {
   }
 }
 
-void init_diagonals(LookupTable *lut) {
-
-  int i;
-
-  bitset<64> diagonal = MAIN_DIAGONAL;
-
-  for (i = 0; i < DIAGONALS / 2; i++) {
-    lut->mask_diagonal[i] = diagonal;
-    diagonal <<= 8;
+void init_sliding_masks(LookupTable *lut) {
+  for (int square = 0; square < SQUARES; square++) {
+    /* Board edges are irrelevant for the occupancy unless the piece is on
+     * them */
+    Bitset64 edges =
+        ((lut->mask_rank[0] | lut->mask_rank[7]) &
+         lut->clear_rank[square / 8]) |
+        ((lut->mask_file[0] | lut->mask_file[7]) & lut->clear_file[square % 8]);
+
+    lut->bishop_magics[square].mask =
+        generate_sliding_attack(bishop_directions, square, 0) & ~edges;
+    lut->rook_magics[square].mask =
+        generate_sliding_attack(rook_directions, square, 0) & ~edges;
   }
+}
 
-  diagonal = MAIN_DIAGONAL;
-  diagonal >>= 8;
-  for (i = 15; i >= DIAGONALS / 2; i--) {
-    lut->mask_diagonal[i] = diagonal;
-    diagonal >>= 8;
-  }
+Bitset64 generate_sliding_attack(const int directions[4][2], int square,
+                                 Bitset64 occupancy) {
+  Bitset64 attacks;
 
-  lut->mask_diagonal[DIAGONALS].reset();
+  for (int i = 0; i < 4; i++) {
+    int rank = square / 8 + directions[i][0];
+    int file = square % 8 + directions[i][1];
 
-  bitset<64> antidiagonal = MAIN_ANTIDIAGONAL;
+    /* Walk the ray until the edge of the board or the first blocker */
+    while (rank >= 0 && rank < RANKS && file >= 0 && file < FILES) {
+      int target = rank * 8 + file;
+      attacks.set(target);
 
-  for (i = 0; i < DIAGONALS / 2; i++) {
-    lut->mask_antidiagonal[i] = antidiagonal;
-    antidiagonal >>= 8;
-  }
+      if (occupancy.test(target))
+        break;
 
-  antidiagonal = MAIN_ANTIDIAGONAL;
-  antidiagonal <<= 8;
-  for (i = 15; i >= DIAGONALS / 2; i--) {
-    lut->mask_antidiagonal[i] = antidiagonal;
-    antidiagonal <<= 8;
+      rank += directions[i][0];
+      file += directions[i][1];
+    }
   }
 
-  lut->mask_antidiagonal[DIAGONALS].reset();
+  return attacks;
 }
 
-int generate_rank_attack(int o, int f) {
-  int x, y;
-  int b;
-  y = 0;
-  for (x = f - 1; x >= 0; --x) {
-    b = 1 << x;
-    y |= b;
-    if ((o & b) == b)
-      break;
-  }
-  for (x = f + 1; x < 8; ++x) {
-    b = 1 << x;
-    y |= b;
-    if ((o & b) == b)
-      break;
+void init_magics(Magic magics[SQUARES], Bitset64 *table,
+                 const int directions[4][2]) {
+  Bitset64 occupancy[4096], reference[4096];
+
+#ifndef USE_PEXT
+  /* Per rank seeds that find the magics quickly */
+  const uint64_t seeds[RANKS] = {728,   10316, 55013, 32803,
+                                 12281, 15100, 16645, 255};
+  int epoch[4096] = {0};
+  int attempt = 0;
+#endif
+
+  for (int square = 0; square < SQUARES; square++) {
+    Magic *m = &magics[square];
+    uint64_t mask = m->mask.to_ullong();
+
+    m->shift = 64 - m->mask.count();
+    m->magic = 0;
+    m->attacks = table;
+
+    /* Enumerate all subsets of the mask with the Carry-Rippler trick */
+    int size = 0;
+    uint64_t subset = 0;
+    do {
+      occupancy[size] = subset;
+      reference[size] = generate_sliding_attack(directions, square, subset);
+      size++;
+      subset = (subset - mask) & mask;
+    } while (subset != 0);
+
+    /* The subtable of the next square starts right after this one */
+    table += size;
+
+#ifdef USE_PEXT
+    for (int i = 0; i < size; i++) {
+      m->attacks[magic_index(*m, occupancy[i])] = reference[i];
+    }
+#else
+    /* Try sparse random candidates until one maps every occupancy to a
+     * non conflicting entry */
+    uint64_t seed = seeds[square / 8];
+    int i = 0;
+    while (i < size) {
+      do {
+        m->magic = random_u64(&seed) & random_u64(&seed) & random_u64(&seed);
+      } while (popcount((mask * m->magic) >> 56) < 6);
+
+      attempt++;
+      for (i = 0; i < size; i++) {
+        unsigned int index = magic_index(*m, occupancy[i]);
+
+        if (epoch[index] < attempt) {
+          epoch[index] = attempt;
+          m->attacks[index] = reference[i];
+        } else if (m->attacks[index] != reference[i]) {
+          break;
+        }
+      }
+    }
+#endif
   }
-  return y;
 }
 
-void init_first_rank_attacks(LookupTable *lut) {
-  for (int i = 0; i < SQUARES; ++i) {
-    for (int j = 0; j < RANKS; ++j) {
-      lut->mask_first_rank_attacks[i * RANKS + j] =
-          generate_rank_attack(i * 2, j);
+void init_lines(LookupTable *lut) {
+  for (int s1 = 0; s1 < SQUARES; s1++) {
+    for (int s2 = 0; s2 < SQUARES; s2++) {
+      lut->between[s1][s2].reset();
+      lut->line[s1][s2].reset();
+
+      if (s1 == s2)
+        continue;
+
+      Bitset64 b1 = lut->piece_lookup[s1];
+      Bitset64 b2 = lut->piece_lookup[s2];
+
+      /* Squares sharing a rank or file are joined by a rook ray, squares
+       * sharing a diagonal by a bishop ray, and other pairs by nothing */
+      if (rook_attacks(lut, s1, 0).test(s2)) {
+        lut->line[s1][s2] =
+            (rook_attacks(lut, s1, 0) & rook_attacks(lut, s2, 0)) | b1 | b2;
+        lut->between[s1][s2] =
+            rook_attacks(lut, s1, b2) & rook_attacks(lut, s2, b1);
+      } else if (bishop_attacks(lut, s1, 0).test(s2)) {
+        lut->line[s1][s2] =
+            (bishop_attacks(lut, s1, 0) & bishop_attacks(lut, s2, 0)) | b1 |
+            b2;
+        lut->between[s1][s2] =
+            bishop_attacks(lut, s1, b2) & bishop_attacks(lut, s2, b1);
+      }
     }
   }
 }
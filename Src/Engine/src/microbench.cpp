@@ -0,0 +1,257 @@
+#include "../includes/bench.h"
+#include "../includes/bitboard.h"
+#include "../includes/fen.h"
+#include "../includes/lookup_table.h"
+#include "../includes/model.h"
+#include "../includes/move.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+/* Minimum time in ms every microbenchmark runs for */
+#define MICROBENCH_MIN_MS 250
+
+using namespace std;
+
+/* Heap allocations of the whole program, counted by the replaced global
+ * operator new. The array and nothrow forms end up calling this one */
+atomic<uint64_t> allocations(0);
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, memory_order_relaxed);
+
+  void *ptr = malloc(size > 0 ? size : 1);
+  if (ptr == nullptr) {
+    throw bad_alloc();
+  }
+
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+/* Results are accumulated here so the compiler cannot drop the work */
+volatile uint64_t sink;
+
+/**
+ * Runs a pass over the corpus until MICROBENCH_MIN_MS have elapsed, after
+ * a warm up pass, and prints the time and heap allocations per operation
+ *
+ * @param const string & name of the microbenchmark
+ * @param const string & only names containing it are run
+ * @param const function<uint64_t()> & pass, returning the operations done
+ */
+void run_microbench(const string &name, const string &filter,
+                    const function<uint64_t()> &pass) {
+  if (name.find(filter) == name.npos) {
+    return;
+  }
+
+  pass();
+
+  uint64_t ops = 0;
+  uint64_t allocations_start = allocations.load(memory_order_relaxed);
+  auto start = chrono::steady_clock::now();
+  int64_t ns;
+
+  do {
+    ops += pass();
+    auto elapsed = chrono::steady_clock::now() - start;
+    ns = chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+  } while (ns < MICROBENCH_MIN_MS * 1000000LL);
+
+  uint64_t allocated =
+      allocations.load(memory_order_relaxed) - allocations_start;
+
+  cout << left << setw(24) << name << right << fixed << setprecision(1)
+       << setw(14) << (double)ns / ops << setprecision(2) << setw(12)
+       << (double)allocated / ops << endl;
+}
+
+int main(int argc, char *argv[]) {
+  /* microbench [filter] [--model path] [--backend name] */
+  string filter;
+  string model_path = "chess.onnx";
+  string backend = eval_backend_names[BACKEND_AUTO];
+
+  for (int i = 1; i < argc; i++) {
+    if (string(argv[i]) == "--model" && i + 1 < argc) {
+      model_path = argv[++i];
+    } else if (string(argv[i]) == "--backend" && i + 1 < argc) {
+      backend = argv[++i];
+    } else {
+      filter = argv[i];
+    }
+  }
+
+  LookupTable *lut = init_lookup_table();
+
+  /* Corpus of the bench positions, with their moves and occupancies */
+  vector<string> fens(bench_positions,
+                      bench_positions + bench_position_count);
+  vector<Bitboard> boards;
+  vector<MoveList> move_lists(fens.size());
+  vector<Bitset64> occupancies;
+
+  for (size_t i = 0; i < fens.size(); i++) {
+    boards.push_back(parse_fen(lut, fens[i]));
+    boards[i].generateMoves(&move_lists[i]);
+
+    Bitset64 occupancy;
+    for (int piece = 0; piece < 12; piece++) {
+      occupancy |= boards[i].getPieces()[piece];
+    }
+    occupancies.push_back(occupancy);
+  }
+
+  cout << left << setw(24) << "benchmark" << right << setw(14) << "ns/op"
+       << setw(12) << "allocs/op" << endl;
+
+  run_microbench("generateMoves", filter, [&]() {
+    MoveList move_list;
+
+    for (Bitboard &bb : boards) {
+      bb.generateMoves(&move_list);
+      sink = sink + move_list.size();
+    }
+
+    return boards.size();
+  });
+
+  /* A move made is always unmade, so the pair is timed together */
+  run_microbench("makeMove+unmakeMove", filter, [&]() {
+    uint64_t ops = 0;
+
+    for (size_t i = 0; i < boards.size(); i++) {
+      for (Move m : move_lists[i]) {
+        UndoInfo undo;
+        boards[i].makeMove(m, &undo);
+        sink = sink + boards[i].getHash();
+        boards[i].unmakeMove(undo);
+      }
+
+      ops += move_lists[i].size();
+    }
+
+    return ops;
+  });
+
+  run_microbench("bishop_attacks", filter, [&]() {
+    uint64_t attacks = 0;
+
+    for (Bitset64 occupancy : occupancies) {
+      for (int square = 0; square < SQUARES; square++) {
+        attacks ^= bishop_attacks(lut, square, occupancy).to_ullong();
+      }
+    }
+
+    sink = sink + attacks;
+    return occupancies.size() * SQUARES;
+  });
+
+  run_microbench("rook_attacks", filter, [&]() {
+    uint64_t attacks = 0;
+
+    for (Bitset64 occupancy : occupancies) {
+      for (int square = 0; square < SQUARES; square++) {
+        attacks ^= rook_attacks(lut, square, occupancy).to_ullong();
+      }
+    }
+
+    sink = sink + attacks;
+    return occupancies.size() * SQUARES;
+  });
+
+  run_microbench("isSquareAttacked", filter, [&]() {
+    uint64_t attacked = 0;
+
+    for (Bitboard &bb : boards) {
+      for (int square = 0; square < SQUARES; square++) {
+        attacked += bb.isSquareAttacked(WHITE, square);
+        attacked += bb.isSquareAttacked(BLACK, square);
+      }
+    }
+
+    sink = sink + attacked;
+    return boards.size() * SQUARES * 2;
+  });
+
+  run_microbench("parse_fen", filter, [&]() {
+    for (const string &fen : fens) {
+      sink = sink + parse_fen(lut, fen).getHash();
+    }
+
+    return fens.size();
+  });
+
+  /* The network is optional, the rest runs without a model file */
+  if (string("predict_batch").find(filter) != string::npos) {
+    unique_ptr<ChessNN> nn;
+
+    try {
+      nn = make_unique<ChessNN>(model_path);
+    } catch (const Ort::Exception &e) {
+      cout << "predict: cannot load " << model_path << ": " << e.what()
+           << endl;
+    }
+
+    if (nn != nullptr) {
+      auto found =
+          find(begin(eval_backend_names), end(eval_backend_names), backend);
+
+      if (found == end(eval_backend_names) ||
+          nn->setBackend((EvalBackend)(found - begin(eval_backend_names))) ==
+              false) {
+        cout << "predict: backend " << backend << " not available" << endl;
+      }
+
+      cout << "predict: backend " << eval_backend_names[nn->getBackend()]
+           << endl;
+
+      run_microbench("predict", filter, [&]() {
+        float eval = 0.0f;
+
+        for (Bitboard &bb : boards) {
+          eval += nn->predict(bb.getPieces(), bb.getTurn());
+        }
+
+        sink = sink + (uint64_t)(eval != 0.0f);
+        return boards.size();
+      });
+
+      /* The whole corpus is a single batch */
+      auto pieces_bb = make_unique<Bitset64[][12]>(boards.size());
+      vector<int> turns(boards.size());
+      vector<float> evals(boards.size());
+
+      for (size_t i = 0; i < boards.size(); i++) {
+        Bitset64 *pieces = boards[i].getPieces();
+        copy(pieces, pieces + 12, pieces_bb[i]);
+        turns[i] = boards[i].getTurn();
+      }
+
+      nn->setBatchSize(NN_MAX_BATCH);
+
+      run_microbench("predict_batch", filter, [&]() {
+        nn->predict_batch(pieces_bb.get(), turns.data(), boards.size(),
+                          evals.data());
+
+        sink = sink + (uint64_t)(evals[0] != 0.0f);
+        return boards.size();
+      });
+    }
+  }
+
+  free(lut);
+  return 0;
+}
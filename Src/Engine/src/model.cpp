@@ -1,83 +1,344 @@
 #include "../includes/model.h"
 #include <algorithm>
+#include <bit>
+#include <cassert>
 #include <cmath>
+#include <fstream>
 
 using namespace std;
 
-ChessNN::ChessNN(const string &model_path)
-    : env(ORT_LOGGING_LEVEL_WARNING, "chess_nn"), session_options(),
-      session(env, model_path.c_str(), session_options) {}
+NNBinding::NNBinding(Ort::Session &session, const Ort::MemoryInfo &mem_info,
+                     const string &input_name, const string &output_name,
+                     const vector<int64_t> &output_shape, int batch)
+    : batch(batch), inputTensor(nullptr), outputTensor(nullptr),
+      binding(session) {
+  const int64_t input_shape[] = {batch, 2, NN_INPUT_SIZE};
 
-pair<vector<float>, vector<float>>
-ChessNN::board_to_input(const bitset<64> *pieces_bb, const int turn) {
-  vector<float> input_white, input_black;
+  /* The dynamic dimension of the output is the batch */
+  vector<int64_t> shape = output_shape;
+  size_t output_size = 1;
 
-  input_white.reserve(769);
-  input_black.reserve(769);
+  for (int64_t &dim : shape) {
+    if (dim <= 0) {
+      dim = batch;
+    }
+    output_size *= dim;
+  }
 
-  if (turn == 0) {
-    input_white.push_back(1.0f);
-    input_black.push_back(0.0f);
-  } else {
-    input_white.push_back(0.0f);
-    input_black.push_back(1.0f);
+  input.assign(batch * 2 * NN_INPUT_SIZE, 0.0f);
+  output.assign(output_size, 0.0f);
+
+  inputTensor = Ort::Value::CreateTensor<float>(
+      mem_info, input.data(), input.size(), input_shape, 3);
+  outputTensor = Ort::Value::CreateTensor<float>(
+      mem_info, output.data(), output.size(), shape.data(), shape.size());
+
+  binding.BindInput(input_name.c_str(), inputTensor);
+  binding.BindOutput(output_name.c_str(), outputTensor);
+}
+
+OnnxConfig init_onnx_config() {
+  OnnxConfig config;
+
+  config.intraOpThreads = NN_DEFAULT_INTRA_THREADS;
+  config.interOpThreads = NN_DEFAULT_INTER_THREADS;
+  config.optimizationLevel = ORT_ENABLE_ALL;
+  config.optimizedModelPath = "";
+
+  return config;
+}
+
+ChessNN::ChessNN(const string &model_path, const OnnxConfig &config)
+    : model_path(model_path), onnx_config(config),
+      env(ORT_LOGGING_LEVEL_WARNING, "chess_nn"),
+      mem_info(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator,
+                                          OrtMemTypeDefault)),
+      batch_size(NN_DEFAULT_BATCH), max_batch(NN_MAX_BATCH),
+      fixed_batch(false) {
+  /* The quantized weights are preferred to the float ones */
+  string weights_path = model_path.substr(0, model_path.rfind('.'));
+  native_loaded = native.load(weights_path + ".qnnue") ||
+                  native.load(weights_path + ".nnue");
+
+  /* Without the native weights the model must load */
+  if (native_loaded == false) {
+    loadSession();
+  }
+
+  setThreads(1);
+  setBackend(BACKEND_AUTO);
+}
+
+unique_ptr<Ort::Session> ChessNN::createSession() {
+  Ort::SessionOptions session_options;
+  string path = model_path;
+  GraphOptimizationLevel level = onnx_config.optimizationLevel;
+
+  session_options.SetIntraOpNumThreads(onnx_config.intraOpThreads);
+  session_options.SetInterOpNumThreads(onnx_config.interOpThreads);
+
+  /* The inter-op threads only run the independent nodes in parallel mode */
+  session_options.SetExecutionMode(
+      (onnx_config.interOpThreads > 1) ? ORT_PARALLEL : ORT_SEQUENTIAL);
+
+  /* An optimized model saved by a previous run is loaded as it is, it is
+   * deleted to optimize the model again */
+  const string &optimized_path = onnx_config.optimizedModelPath;
+
+  if (optimized_path != "") {
+    if (ifstream(optimized_path).good()) {
+      path = optimized_path;
+      level = ORT_DISABLE_ALL;
+    } else {
+      session_options.SetOptimizedModelFilePath(optimized_path.c_str());
+    }
+  }
+
+  session_options.SetGraphOptimizationLevel(level);
+
+  return make_unique<Ort::Session>(env, path.c_str(), session_options);
+}
+
+void ChessNN::useSession(unique_ptr<Ort::Session> created) {
+  for (vector<unique_ptr<NNBinding>> &thread_bindings : bindings) {
+    thread_bindings.clear();
   }
 
-  for (int i = 0; i < 12; i += 2) {
-    for (int sq = 0; sq < 64; sq++) {
-      input_white.push_back((float)pieces_bb[i][sq]);
-      input_black.push_back((float)pieces_bb[i][sq ^ 56]);
+  session = move(created);
+
+  input_name = session->GetInputNames()[0];
+  output_name = session->GetOutputNames()[0];
+  output_shape =
+      session->GetOutputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
+
+  /* Models exported with a fixed batch dimension only take that batch */
+  int64_t input_batch =
+      session->GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape()[0];
+  fixed_batch = input_batch > 0;
+  max_batch = fixed_batch ? input_batch : NN_MAX_BATCH;
+  batch_size = min(batch_size, max_batch);
+}
+
+void ChessNN::loadSession() {
+  if (session == nullptr) {
+    useSession(createSession());
+  }
+}
+
+bool ChessNN::setOnnxConfig(const OnnxConfig &config) {
+  OnnxConfig previous = onnx_config;
+  onnx_config = config;
+
+  /* Otherwise the settings apply when the session is created */
+  if (session == nullptr) {
+    return true;
+  }
+
+  try {
+    useSession(createSession());
+  } catch (const Ort::Exception &e) {
+    onnx_config = previous;
+    return false;
+  }
+
+  return true;
+}
+
+OnnxConfig ChessNN::getOnnxConfig() { return onnx_config; }
+
+bool ChessNN::setBackend(EvalBackend requested) {
+  if (requested == BACKEND_AUTO) {
+    requested = BACKEND_ONNX;
+
+    if (native_loaded) {
+      requested = (EvalBackend)(BACKEND_SCALAR + (int)best_simd_level());
     }
   }
 
-  for (int i = 1; i < 12; i += 2) {
-    for (int sq = 0; sq < 64; sq++) {
-      input_white.push_back((float)pieces_bb[i][sq]);
-      input_black.push_back((float)pieces_bb[i][sq ^ 56]);
+  if (requested == BACKEND_ONNX) {
+    try {
+      loadSession();
+    } catch (const Ort::Exception &e) {
+      return false;
     }
+  } else if (native_loaded == false ||
+             native.setSimd((SimdLevel)(requested - BACKEND_SCALAR)) ==
+                 false) {
+    return false;
   }
-  return {input_white, input_black};
+
+  backend = requested;
+  return true;
 }
 
-float ChessNN::predict(const bitset<64> *pieces_bb, const int turn) {
-  auto [input_white, input_black] = board_to_input(pieces_bb, turn);
+EvalBackend ChessNN::getBackend() { return backend; }
 
-  vector<float> input(2 * 769);
-  for (int i = 0; i < 769; ++i) {
-    input[0 * (2 * 769) + 0 * 769 + i] = input_white[i];
-    input[0 * (2 * 769) + 1 * 769 + i] = input_black[i];
+void ChessNN::board_to_input(const Bitset64 *pieces_bb, const int turn,
+                             float *input) {
+  float *input_white = input;
+  float *input_black = input + NN_INPUT_SIZE;
+
+  fill(input, input + 2 * NN_INPUT_SIZE, 0.0f);
+
+  if (turn == 0) {
+    input_white[0] = 1.0f;
+  } else {
+    input_black[0] = 1.0f;
   }
 
-  vector<int64_t> input_shape = {1, 2, 769};
+  /* White pieces planes go first and black pieces planes after them, and
+   * the black perspective mirrors the ranks */
+  for (int i = 0; i < 12; i++) {
+    int plane = 1 + ((i % 2) * 6 + i / 2) * 64;
+    Bitset64 bb = pieces_bb[i];
 
-  Ort::MemoryInfo mem_info =
-      Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+    while (bb.any()) {
+      int sq = bb.popLsb();
+      input_white[plane + sq] = 1.0f;
+      input_black[plane + (sq ^ 56)] = 1.0f;
+    }
+  }
+}
 
-  Ort::Value input_tensor =
-      Ort::Value::CreateTensor<float>(mem_info, input.data(), input.size(),
-                                      input_shape.data(), input_shape.size());
+void ChessNN::setThreads(int threads) {
+  if ((int)bindings.size() < threads) {
+    bindings.resize(threads);
+    accumulators.resize(threads);
+    scratch.resize(threads);
+  }
+}
 
-  std::vector<std::string> input_names = session.GetInputNames();
-  std::vector<std::string> output_names = session.GetOutputNames();
+void ChessNN::setBatchSize(int batch) {
+  batch_size = clamp(batch, 1, max_batch);
+}
 
-  std::vector<const char *> input_ptrs;
-  std::vector<const char *> output_ptrs;
-  for (const auto &s : input_names)
-    input_ptrs.push_back(s.c_str());
-  for (const auto &s : output_names)
-    output_ptrs.push_back(s.c_str());
+int ChessNN::getBatchSize() { return batch_size; }
 
-  Ort::RunOptions run_options;
+NNBinding &ChessNN::getBinding(int thread, int batch) {
+  vector<unique_ptr<NNBinding>> &thread_bindings = bindings[thread];
 
-  auto output_tensors = session.Run(run_options, input_ptrs.data(),
-                                    &input_tensor, 1, output_ptrs.data(), 1);
+  /* Bounds the buffers of a thread to about twice the maximum batch */
+  int size = fixed_batch ? max_batch
+                         : min((int)bit_ceil((unsigned)batch), max_batch);
+  int index = bit_width((unsigned)size - 1);
 
-  float *output_data = output_tensors.front().GetTensorMutableData<float>();
-  float result = output_data[0];
+  if ((int)thread_bindings.size() <= index) {
+    thread_bindings.resize(index + 1);
+  }
+
+  unique_ptr<NNBinding> &buffers = thread_bindings[index];
 
+  if (buffers == nullptr) {
+    buffers = make_unique<NNBinding>(*session, mem_info, input_name,
+                                     output_name, output_shape, size);
+  }
+
+  return *buffers;
+}
+
+void ChessNN::run(NNBinding &buffers, int batch, float *evals) {
+  session->Run(run_options, buffers.binding);
+
+  int stride = buffers.output.size() / buffers.batch;
   float epsilon = 1e-7f;
-  result = clamp(result, epsilon, 1.0f - epsilon);
-  float linear_result = log(result / (1.0f - result)) * 400;
 
-  return linear_result;
+  /* The network predicts a winning probability, turned into centipawns */
+  for (int i = 0; i < batch; i++) {
+    float result = clamp(buffers.output[i * stride], epsilon, 1.0f - epsilon);
+    evals[i] = log(result / (1.0f - result)) * 400;
+  }
+}
+
+bool ChessNN::isNative() { return backend != BACKEND_ONNX; }
+
+void ChessNN::attach(Bitboard *bb, int thread) {
+  if (isNative() == false) {
+    bb->setAccumulators(nullptr);
+    return;
+  }
+
+  unique_ptr<AccumulatorStack> &stack = accumulators[thread];
+
+  if (stack == nullptr) {
+    stack = make_unique<AccumulatorStack>();
+    stack->entries.resize(ACCUMULATOR_STACK_SIZE);
+  }
+
+  bb->setAccumulators(stack.get());
+  native.refresh(&stack->entries[0], bb->getPieces(), bb->getTurn());
+}
+
+float ChessNN::evaluate(Bitboard *bb, int thread) {
+  AccumulatorStack *stack = bb->getAccumulators();
+
+  if (stack == nullptr) {
+    return predict(bb->getPieces(), bb->getTurn(), thread);
+  }
+
+  float eval = native.evaluate(stack);
+
+#ifdef DEBUG
+  /* The updated accumulator matches the one computed from scratch */
+  auto acc = make_unique<Accumulator>();
+  native.refresh(acc.get(), bb->getPieces(), bb->getTurn());
+
+  const Accumulator &top = stack->entries[stack->top];
+
+  for (int p = 0; p < 2; p++) {
+    for (int j = 0; j < NNUE_L1; j++) {
+      if (native.isQuantized()) {
+        assert(acc->qvalues[p][j] == top.qvalues[p][j]);
+      } else {
+        assert(fabs(acc->values[p][j] - top.values[p][j]) < 1e-3f);
+      }
+    }
+  }
+#endif
+
+  return eval;
+}
+
+float ChessNN::predict(const Bitset64 *pieces_bb, const int turn,
+                       int thread) {
+  if (isNative()) {
+    unique_ptr<Accumulator> &acc = scratch[thread];
+
+    if (acc == nullptr) {
+      acc = make_unique<Accumulator>();
+    }
+
+    native.refresh(acc.get(), pieces_bb, turn);
+    return native.evaluate(acc.get());
+  }
+
+  NNBinding &buffers = getBinding(thread, 1);
+  float eval;
+
+  board_to_input(pieces_bb, turn, buffers.input.data());
+  run(buffers, 1, &eval);
+
+  return eval;
+}
+
+void ChessNN::predict_batch(const Bitset64 (*pieces_bb)[12], const int *turns,
+                            int count, float *evals, int thread) {
+  /* The native evaluator gains nothing from batches */
+  if (isNative()) {
+    for (int i = 0; i < count; i++) {
+      evals[i] = predict(pieces_bb[i], turns[i], thread);
+    }
+    return;
+  }
+
+  for (int first = 0; first < count; first += batch_size) {
+    int batch = min(count - first, batch_size);
+    NNBinding &buffers = getBinding(thread, batch);
+
+    for (int i = 0; i < batch; i++) {
+      board_to_input(pieces_bb[first + i], turns[first + i],
+                     buffers.input.data() + i * 2 * NN_INPUT_SIZE);
+    }
+
+    run(buffers, batch, evals + first);
+  }
 }
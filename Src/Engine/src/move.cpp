@@ -2,32 +2,6 @@
 #include "../includes/utils.h"
 #include <iostream>
 
-Move::Move() {
-  sourceSquare = no_square;
-  targetSquare = no_square;
-  flag = QUIET_MOVE;
-  piece = NO_PIECE;
-  color = NONE;
-}
-
-Move::Move(int source_square, int target_square, int fl, int piece_t, int clr) {
-  sourceSquare = source_square;
-  targetSquare = target_square;
-  flag = fl;
-  piece = piece_t;
-  color = clr;
-}
-
-unsigned long Move::getSourceSquare() { return sourceSquare.to_ulong(); }
-
-unsigned long Move::getTargetSquare() { return targetSquare.to_ulong(); }
-
-unsigned long Move::getFlag() { return flag.to_ulong(); }
-
-unsigned long Move::getPiece() { return piece.to_ulong(); }
-
-unsigned long Move::getColor() { return color.to_ulong(); }
-
 string Move::parsePiece() {
   int piece = getPiece();
 
@@ -50,7 +24,7 @@ string Move::parsePiece() {
 }
 
 string Move::formatFlag() {
-  switch (flag.to_ulong()) {
+  switch (getFlag()) {
   case QUIET_MOVE:
     return "move";
   case DOUBLE_PAWN_PUSH:
@@ -114,29 +88,24 @@ string Move::formatToAlgebraic() {
   return algebraic_notation;
 }
 
-bool Move::operator==(const Move &move) {
-
-  if (sourceSquare.to_ulong() != move.sourceSquare.to_ulong())
-    return false;
-
-  if (targetSquare.to_ulong() != move.targetSquare.to_ulong())
-    return false;
+string Move::formatToUci() {
+  string uci_notation;
 
-  if (flag.to_ulong() != move.flag.to_ulong())
-    return false;
+  uci_notation.append(coordinateToSquare[getSourceSquare()]);
+  uci_notation.append(coordinateToSquare[getTargetSquare()]);
 
-  if (piece.to_ulong() != move.piece.to_ulong())
-    return false;
-
-  if (color.to_ulong() != move.color.to_ulong())
-    return false;
+  /* Promotions append the lowercase promoted piece */
+  int flag = getFlag();
+  if (flag >= KNIGHT_PROMOTION && flag <= QUEEN_PROMOTION_CAPTURE) {
+    uci_notation.push_back("nbrq"[(flag - KNIGHT_PROMOTION) % 4]);
+  }
 
-  return true;
+  return uci_notation;
 }
 
 void Move::printMove() {
-  cout << coordinateToSquare[sourceSquare.to_ulong()] << " ";
-  cout << coordinateToSquare[targetSquare.to_ulong()] << " ";
+  cout << coordinateToSquare[getSourceSquare()] << " ";
+  cout << coordinateToSquare[getTargetSquare()] << " ";
   cout << getFlag();
   cout << getPiece();
   cout << getColor();
@@ -145,13 +114,12 @@ void Move::printMove() {
 
 void Move::prettyPrintMove() {
   cout << "source square: ";
-  cout << coordinateToSquare[sourceSquare.to_ulong()] << " ";
+  cout << coordinateToSquare[getSourceSquare()] << " ";
   cout << "target square: ";
-  cout << coordinateToSquare[targetSquare.to_ulong()] << " ";
+  cout << coordinateToSquare[getTargetSquare()] << " ";
   cout << "flag: ";
   cout << formatFlag() << " ";
-  int piece_t = (color.to_ulong() == WHITE) ? piece.to_ulong() * 2
-                                            : piece.to_ulong() * 2 + 1;
+  int piece_t = getPiece() * 2 + getColor();
   cout << "piece: " << asciiPieces[piece_t];
   cout << endl;
 }
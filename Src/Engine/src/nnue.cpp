@@ -0,0 +1,791 @@
+#include "../includes/nnue.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Clipped ReLU squared, the activation of every hidden layer
+ *
+ * @param float input of the activation
+ * @return activation
+ */
+inline float crelu2(float x) {
+  x = clamp(x, 0.0f, 1.0f);
+  return x * x;
+}
+
+/**
+ * Quantized clipped ReLU squared, from an integer scaled by the value of
+ * 1.0 to an activation between 0 and NNUE_ACT_ONE
+ *
+ * @param int64_t input of the activation
+ * @param int64_t quantized 1.0 of the input
+ * @return activation, rounded to the nearest integer
+ */
+inline uint8_t crelu2_quantized(int64_t x, int64_t one) {
+  int64_t c = clamp(x, (int64_t)0, one);
+  return (c * c * NNUE_ACT_ONE + one * one / 2) / (one * one);
+}
+
+/**
+ * Turns the output of the last layer into centipawns, the same conversion
+ * as the ONNX model output
+ *
+ * @param float output of the last layer, before the sigmoid
+ * @return evaluation in centipawns
+ */
+inline float logit_to_centipawns(float logit) {
+  float epsilon = 1e-7f;
+  float result = clamp(1.0f / (1.0f + exp(-logit)), epsilon, 1.0f - epsilon);
+
+  return log(result / (1.0f - result)) * 400;
+}
+
+/* Outputs of a dense layer computed together, kept in registers */
+#define DENSE_CHUNK 32
+
+/* Inputs of a quantized dense layer multiplied together, as the int8 pairs
+ * of the kernels are summed in 32 bits */
+#define DENSE_GROUP 4
+
+static_assert(NNUE_L1 % 32 == 0 && NNUE_L2 % DENSE_CHUNK == 0 &&
+              NNUE_L3 % DENSE_CHUNK == 0 && NNUE_L4 % DENSE_CHUNK == 0);
+static_assert(NNUE_L3 % DENSE_GROUP == 0 && NNUE_L4 % DENSE_GROUP == 0);
+
+/*
+ * Kernels of an instruction set. accumulate adds and subtracts weight rows
+ * of the first layer to a row of NNUE_L1 values, and dense computes a
+ * dense layer, adding only the weight rows of the nonzero inputs. The
+ * quantized dense layer takes its weights grouped, DENSE_GROUP inputs of
+ * every output together
+ */
+typedef struct {
+  void (*accumulate)(const float *input, const float *const *added,
+                     int added_count, const float *const *removed,
+                     int removed_count, float *output);
+  void (*dense)(const float *input, int inputs, const float *weights,
+                const float *bias, int outputs, float *output);
+  void (*accumulate_quantized)(const int16_t *input,
+                               const int16_t *const *added, int added_count,
+                               const int16_t *const *removed,
+                               int removed_count, int16_t *output);
+  void (*dense_quantized)(const uint8_t *input, int inputs,
+                          const int8_t *weights, const int32_t *bias,
+                          int outputs, int32_t *output);
+} NNUEKernels;
+
+void accumulate_scalar(const float *input, const float *const *added,
+                       int added_count, const float *const *removed,
+                       int removed_count, float *output) {
+  for (int j = 0; j < NNUE_L1; j++) {
+    float value = input[j];
+
+    for (int i = 0; i < added_count; i++) {
+      value += added[i][j];
+    }
+    for (int i = 0; i < removed_count; i++) {
+      value -= removed[i][j];
+    }
+
+    output[j] = value;
+  }
+}
+
+void dense_scalar(const float *input, int inputs, const float *weights,
+                  const float *bias, int outputs, float *output) {
+  copy(bias, bias + outputs, output);
+
+  for (int i = 0; i < inputs; i++) {
+    if (input[i] == 0.0f) {
+      continue;
+    }
+
+    const float *row = weights + i * outputs;
+    for (int j = 0; j < outputs; j++) {
+      output[j] += input[i] * row[j];
+    }
+  }
+}
+
+void accumulate_quantized_scalar(const int16_t *input,
+                                 const int16_t *const *added, int added_count,
+                                 const int16_t *const *removed,
+                                 int removed_count, int16_t *output) {
+  for (int j = 0; j < NNUE_L1; j++) {
+    int16_t value = input[j];
+
+    for (int i = 0; i < added_count; i++) {
+      value += added[i][j];
+    }
+    for (int i = 0; i < removed_count; i++) {
+      value -= removed[i][j];
+    }
+
+    output[j] = value;
+  }
+}
+
+void dense_quantized_scalar(const uint8_t *input, int inputs,
+                            const int8_t *weights, const int32_t *bias,
+                            int outputs, int32_t *output) {
+  copy(bias, bias + outputs, output);
+
+  for (int g = 0; g < inputs / DENSE_GROUP; g++) {
+    const uint8_t *x = input + g * DENSE_GROUP;
+
+    if ((x[0] | x[1] | x[2] | x[3]) == 0) {
+      continue;
+    }
+
+    const int8_t *row = weights + g * outputs * DENSE_GROUP;
+    for (int j = 0; j < outputs; j++) {
+      for (int k = 0; k < DENSE_GROUP; k++) {
+        output[j] += x[k] * row[j * DENSE_GROUP + k];
+      }
+    }
+  }
+}
+
+/**
+ * Collects the indexes of the nonzero inputs of a dense layer
+ *
+ * @param const float * inputs
+ * @param int number of inputs
+ * @param int * where the indexes are written
+ * @return number of nonzero inputs
+ */
+inline int nonzero_inputs(const float *input, int inputs, int *nonzero) {
+  int count = 0;
+
+  for (int i = 0; i < inputs; i++) {
+    if (input[i] != 0.0f) {
+      nonzero[count++] = i;
+    }
+  }
+
+  return count;
+}
+
+/**
+ * Collects the groups of DENSE_GROUP inputs of a quantized dense layer
+ * with a nonzero input, as the inputs of the group packed in 32 bits
+ *
+ * @param const uint8_t * inputs
+ * @param int number of inputs
+ * @param int * where the indexes of the groups are written
+ * @param int32_t * where the inputs of the groups are written
+ * @return number of groups with a nonzero input
+ */
+inline int nonzero_groups(const uint8_t *input, int inputs, int *nonzero,
+                          int32_t *packed) {
+  int count = 0;
+
+  for (int g = 0; g < inputs / DENSE_GROUP; g++) {
+    int32_t x;
+    memcpy(&x, input + g * DENSE_GROUP, sizeof(x));
+
+    if (x != 0) {
+      nonzero[count] = g;
+      packed[count++] = x;
+    }
+  }
+
+  return count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2,fma"))) void
+accumulate_avx2(const float *input, const float *const *added,
+                int added_count, const float *const *removed,
+                int removed_count, float *output) {
+  for (int j = 0; j < NNUE_L1; j += 8) {
+    __m256 value = _mm256_loadu_ps(input + j);
+
+    for (int i = 0; i < added_count; i++) {
+      value = _mm256_add_ps(value, _mm256_loadu_ps(added[i] + j));
+    }
+    for (int i = 0; i < removed_count; i++) {
+      value = _mm256_sub_ps(value, _mm256_loadu_ps(removed[i] + j));
+    }
+
+    _mm256_storeu_ps(output + j, value);
+  }
+}
+
+__attribute__((target("avx2,fma"))) void
+dense_avx2(const float *input, int inputs, const float *weights,
+           const float *bias, int outputs, float *output) {
+  int nonzero[NNUE_L1];
+  int count = nonzero_inputs(input, inputs, nonzero);
+
+  for (int c = 0; c < outputs; c += DENSE_CHUNK) {
+    __m256 sum[DENSE_CHUNK / 8];
+
+    for (int k = 0; k < DENSE_CHUNK / 8; k++) {
+      sum[k] = _mm256_loadu_ps(bias + c + k * 8);
+    }
+
+    for (int i = 0; i < count; i++) {
+      __m256 x = _mm256_set1_ps(input[nonzero[i]]);
+      const float *row = weights + nonzero[i] * outputs + c;
+
+      for (int k = 0; k < DENSE_CHUNK / 8; k++) {
+        sum[k] = _mm256_fmadd_ps(x, _mm256_loadu_ps(row + k * 8), sum[k]);
+      }
+    }
+
+    for (int k = 0; k < DENSE_CHUNK / 8; k++) {
+      _mm256_storeu_ps(output + c + k * 8, sum[k]);
+    }
+  }
+}
+
+__attribute__((target("avx512f"))) void
+accumulate_avx512(const float *input, const float *const *added,
+                  int added_count, const float *const *removed,
+                  int removed_count, float *output) {
+  for (int j = 0; j < NNUE_L1; j += 16) {
+    __m512 value = _mm512_loadu_ps(input + j);
+
+    for (int i = 0; i < added_count; i++) {
+      value = _mm512_add_ps(value, _mm512_loadu_ps(added[i] + j));
+    }
+    for (int i = 0; i < removed_count; i++) {
+      value = _mm512_sub_ps(value, _mm512_loadu_ps(removed[i] + j));
+    }
+
+    _mm512_storeu_ps(output + j, value);
+  }
+}
+
+__attribute__((target("avx512f"))) void
+dense_avx512(const float *input, int inputs, const float *weights,
+             const float *bias, int outputs, float *output) {
+  int nonzero[NNUE_L1];
+  int count = nonzero_inputs(input, inputs, nonzero);
+
+  for (int c = 0; c < outputs; c += DENSE_CHUNK) {
+    __m512 sum[DENSE_CHUNK / 16];
+
+    for (int k = 0; k < DENSE_CHUNK / 16; k++) {
+      sum[k] = _mm512_loadu_ps(bias + c + k * 16);
+    }
+
+    for (int i = 0; i < count; i++) {
+      __m512 x = _mm512_set1_ps(input[nonzero[i]]);
+      const float *row = weights + nonzero[i] * outputs + c;
+
+      for (int k = 0; k < DENSE_CHUNK / 16; k++) {
+        sum[k] = _mm512_fmadd_ps(x, _mm512_loadu_ps(row + k * 16), sum[k]);
+      }
+    }
+
+    for (int k = 0; k < DENSE_CHUNK / 16; k++) {
+      _mm512_storeu_ps(output + c + k * 16, sum[k]);
+    }
+  }
+}
+
+__attribute__((target("avx2"))) void accumulate_quantized_avx2(
+    const int16_t *input, const int16_t *const *added, int added_count,
+    const int16_t *const *removed, int removed_count, int16_t *output) {
+  for (int j = 0; j < NNUE_L1; j += 16) {
+    __m256i value = _mm256_loadu_si256((const __m256i *)(input + j));
+
+    for (int i = 0; i < added_count; i++) {
+      value = _mm256_add_epi16(
+          value, _mm256_loadu_si256((const __m256i *)(added[i] + j)));
+    }
+    for (int i = 0; i < removed_count; i++) {
+      value = _mm256_sub_epi16(
+          value, _mm256_loadu_si256((const __m256i *)(removed[i] + j)));
+    }
+
+    _mm256_storeu_si256((__m256i *)(output + j), value);
+  }
+}
+
+/* The uint8 inputs of a group times the int8 weights of 8 outputs are
+ * summed in pairs to int16 by maddubs, and the pairs to int32 by madd */
+__attribute__((target("avx2"))) void
+dense_quantized_avx2(const uint8_t *input, int inputs, const int8_t *weights,
+                     const int32_t *bias, int outputs, int32_t *output) {
+  int nonzero[NNUE_L1 / DENSE_GROUP];
+  int32_t packed[NNUE_L1 / DENSE_GROUP];
+  int count = nonzero_groups(input, inputs, nonzero, packed);
+  const __m256i ones = _mm256_set1_epi16(1);
+
+  for (int c = 0; c < outputs; c += DENSE_CHUNK) {
+    __m256i sum[DENSE_CHUNK / 8];
+
+    for (int k = 0; k < DENSE_CHUNK / 8; k++) {
+      sum[k] = _mm256_loadu_si256((const __m256i *)(bias + c + k * 8));
+    }
+
+    for (int i = 0; i < count; i++) {
+      __m256i x = _mm256_set1_epi32(packed[i]);
+      const int8_t *row = weights + (nonzero[i] * outputs + c) * DENSE_GROUP;
+
+      for (int k = 0; k < DENSE_CHUNK / 8; k++) {
+        __m256i w = _mm256_loadu_si256((const __m256i *)(row + k * 32));
+        __m256i pairs = _mm256_maddubs_epi16(x, w);
+        sum[k] = _mm256_add_epi32(sum[k], _mm256_madd_epi16(pairs, ones));
+      }
+    }
+
+    for (int k = 0; k < DENSE_CHUNK / 8; k++) {
+      _mm256_storeu_si256((__m256i *)(output + c + k * 8), sum[k]);
+    }
+  }
+}
+
+__attribute__((target("avx512f,avx512bw"))) void accumulate_quantized_avx512(
+    const int16_t *input, const int16_t *const *added, int added_count,
+    const int16_t *const *removed, int removed_count, int16_t *output) {
+  for (int j = 0; j < NNUE_L1; j += 32) {
+    __m512i value = _mm512_loadu_si512(input + j);
+
+    for (int i = 0; i < added_count; i++) {
+      value = _mm512_add_epi16(value, _mm512_loadu_si512(added[i] + j));
+    }
+    for (int i = 0; i < removed_count; i++) {
+      value = _mm512_sub_epi16(value, _mm512_loadu_si512(removed[i] + j));
+    }
+
+    _mm512_storeu_si512(output + j, value);
+  }
+}
+
+__attribute__((target("avx512f,avx512bw"))) void
+dense_quantized_avx512(const uint8_t *input, int inputs, const int8_t *weights,
+                       const int32_t *bias, int outputs, int32_t *output) {
+  int nonzero[NNUE_L1 / DENSE_GROUP];
+  int32_t packed[NNUE_L1 / DENSE_GROUP];
+  int count = nonzero_groups(input, inputs, nonzero, packed);
+  const __m512i ones = _mm512_set1_epi16(1);
+
+  for (int c = 0; c < outputs; c += DENSE_CHUNK) {
+    __m512i sum[DENSE_CHUNK / 16];
+
+    for (int k = 0; k < DENSE_CHUNK / 16; k++) {
+      sum[k] = _mm512_loadu_si512(bias + c + k * 16);
+    }
+
+    for (int i = 0; i < count; i++) {
+      __m512i x = _mm512_set1_epi32(packed[i]);
+      const int8_t *row = weights + (nonzero[i] * outputs + c) * DENSE_GROUP;
+
+      for (int k = 0; k < DENSE_CHUNK / 16; k++) {
+        __m512i w = _mm512_loadu_si512(row + k * 64);
+        __m512i pairs = _mm512_maddubs_epi16(x, w);
+        sum[k] = _mm512_add_epi32(sum[k], _mm512_madd_epi16(pairs, ones));
+      }
+    }
+
+    for (int k = 0; k < DENSE_CHUNK / 16; k++) {
+      _mm512_storeu_si512(output + c + k * 16, sum[k]);
+    }
+  }
+}
+
+#endif
+
+/* Kernels of every instruction set, indexed by SimdLevel */
+const NNUEKernels nnue_kernels[] = {
+    {accumulate_scalar, dense_scalar, accumulate_quantized_scalar,
+     dense_quantized_scalar},
+#if defined(__x86_64__) || defined(__i386__)
+    {accumulate_avx2, dense_avx2, accumulate_quantized_avx2,
+     dense_quantized_avx2},
+    {accumulate_avx512, dense_avx512, accumulate_quantized_avx512,
+     dense_quantized_avx512},
+#endif
+};
+
+/**
+ * Rearranges the int8 weights of a dense layer from input major to the
+ * groups of the quantized kernels: for every group of DENSE_GROUP inputs,
+ * the weights of every output, those of its inputs together
+ *
+ * @param const vector<int8_t> & input major weights
+ * @param int number of inputs
+ * @param int number of outputs
+ * @return grouped weights
+ */
+vector<int8_t> group_weights(const vector<int8_t> &weights, int inputs,
+                             int outputs) {
+  vector<int8_t> grouped(weights.size());
+
+  for (int i = 0; i < inputs; i++) {
+    for (int j = 0; j < outputs; j++) {
+      int g = i / DENSE_GROUP;
+      grouped[(g * outputs + j) * DENSE_GROUP + i % DENSE_GROUP] =
+          weights[i * outputs + j];
+    }
+  }
+
+  return grouped;
+}
+
+/**
+ * Collects the weight rows of the first layer of the pieces of a position
+ * and of the side to move for a perspective
+ *
+ * @param const T * weights of the first layer of the perspective
+ * @param int perspective, 0 for white and 1 for black
+ * @param const Bitset64 * piece bitboards of the position
+ * @param int side to move
+ * @param const T ** where the rows are written, 65 at most
+ * @return number of rows
+ */
+template <typename T>
+int position_rows(const T *weights, int p, const Bitset64 *pieces_bb,
+                  int turn, const T **rows) {
+  int count = 0;
+
+  /* The side to move input is set in its own perspective */
+  if (turn == p) {
+    rows[count++] = weights;
+  }
+
+  for (int i = 0; i < 12; i++) {
+    Bitset64 bb = pieces_bb[i];
+
+    while (bb.any()) {
+      rows[count++] = weights + nnue_feature(p, i, bb.popLsb()) * NNUE_L1;
+    }
+  }
+
+  return count;
+}
+
+/**
+ * Collects the weight rows of the first layer added and removed by a move
+ * for a perspective
+ *
+ * @param const T * weights of the first layer of the perspective
+ * @param int perspective, 0 for white and 1 for black
+ * @param const DirtyPieces & pieces changed by the move
+ * @param const T ** where the rows added are written
+ * @param int * number of rows added
+ * @param const T ** where the rows removed are written
+ * @param int * number of rows removed
+ */
+template <typename T>
+void dirty_rows(const T *weights, int p, const DirtyPieces &dirty,
+                const T **added, int *added_count, const T **removed,
+                int *removed_count) {
+  *added_count = 0;
+  *removed_count = 0;
+
+  for (int i = 0; i < dirty.count; i++) {
+    if (dirty.from[i] >= 0) {
+      int feature = nnue_feature(p, dirty.piece[i], dirty.from[i]);
+      removed[(*removed_count)++] = weights + feature * NNUE_L1;
+    }
+
+    if (dirty.to[i] >= 0) {
+      int feature = nnue_feature(p, dirty.piece[i], dirty.to[i]);
+      added[(*added_count)++] = weights + feature * NNUE_L1;
+    }
+  }
+
+  /* Every move passes the turn to the other perspective */
+  if (dirty.turn == p) {
+    added[(*added_count)++] = weights;
+  } else {
+    removed[(*removed_count)++] = weights;
+  }
+}
+
+SimdLevel best_simd_level() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw")) {
+    return SIMD_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return SIMD_AVX2;
+  }
+#endif
+
+  return SIMD_SCALAR;
+}
+
+NNUE::NNUE()
+    : quantized(false), bias5(0.0f), qbias5(0), acc_scale(1),
+      simd(best_simd_level()) {}
+
+bool NNUE::setSimd(SimdLevel level) {
+  if (level > best_simd_level()) {
+    return false;
+  }
+
+  simd = level;
+  return true;
+}
+
+SimdLevel NNUE::getSimd() { return simd; }
+
+bool NNUE::isQuantized() { return quantized; }
+
+bool NNUE::load(const string &path) {
+  ifstream file(path, ios::binary);
+
+  if (file.is_open() == false) {
+    return false;
+  }
+
+  uint32_t header[2];
+  if (!file.read(reinterpret_cast<char *>(header), sizeof(header)) ||
+      header[0] != NNUE_MAGIC) {
+    return false;
+  }
+
+  if (header[1] == NNUE_QUANTIZED_VERSION) {
+    return loadQuantized(file);
+  } else if (header[1] != NNUE_VERSION) {
+    return false;
+  }
+
+  auto read = [&](vector<float> &values, size_t size) {
+    values.resize(size);
+    file.read(reinterpret_cast<char *>(values.data()), size * sizeof(float));
+  };
+
+  for (int p = 0; p < 2; p++) {
+    read(weights1[p], NNUE_INPUTS * NNUE_L1);
+    read(bias1[p], NNUE_L1);
+  }
+
+  for (int p = 0; p < 2; p++) {
+    read(weights2[p], NNUE_L1 * NNUE_L2);
+    read(bias2[p], NNUE_L2);
+  }
+
+  read(weights3, 2 * NNUE_L2 * NNUE_L3);
+  read(bias3, NNUE_L3);
+  read(weights4, NNUE_L3 * NNUE_L4);
+  read(bias4, NNUE_L4);
+  read(weights5, NNUE_L4);
+  file.read(reinterpret_cast<char *>(&bias5), sizeof(float));
+
+  /* Nothing may be missing or left over */
+  quantized = false;
+  return file.good() && file.peek() == EOF;
+}
+
+bool NNUE::loadQuantized(ifstream &file) {
+  file.read(reinterpret_cast<char *>(&acc_scale), sizeof(acc_scale));
+  file.read(reinterpret_cast<char *>(shifts), sizeof(shifts));
+
+  if (!file || acc_scale <= 0 || acc_scale > NNUE_MAX_ACC_SCALE) {
+    return false;
+  }
+
+  for (int shift : shifts) {
+    if (shift < 0 || shift > NNUE_MAX_SHIFT) {
+      return false;
+    }
+  }
+
+  auto read = [&](auto &values, size_t size) {
+    values.resize(size);
+    file.read(reinterpret_cast<char *>(values.data()),
+              size * sizeof(values[0]));
+  };
+
+  for (int p = 0; p < 2; p++) {
+    read(qweights1[p], NNUE_INPUTS * NNUE_L1);
+    read(qbias1[p], NNUE_L1);
+  }
+
+  for (int p = 0; p < 2; p++) {
+    read(qweights2[p], NNUE_L1 * NNUE_L2);
+    read(qbias2[p], NNUE_L2);
+    qweights2[p] = group_weights(qweights2[p], NNUE_L1, NNUE_L2);
+  }
+
+  read(qweights3, 2 * NNUE_L2 * NNUE_L3);
+  read(qbias3, NNUE_L3);
+  qweights3 = group_weights(qweights3, 2 * NNUE_L2, NNUE_L3);
+
+  read(qweights4, NNUE_L3 * NNUE_L4);
+  read(qbias4, NNUE_L4);
+  qweights4 = group_weights(qweights4, NNUE_L3, NNUE_L4);
+
+  read(qweights5, NNUE_L4);
+  file.read(reinterpret_cast<char *>(&qbias5), sizeof(qbias5));
+
+  /* The activation of the accumulators is looked up, every leaf computes
+   * 2 * NNUE_L1 of them */
+  acc_activation.resize(acc_scale + 1);
+  for (int32_t x = 0; x <= acc_scale; x++) {
+    acc_activation[x] = crelu2_quantized(x, acc_scale);
+  }
+
+  /* Nothing may be missing or left over */
+  quantized = true;
+  return file.good() && file.peek() == EOF;
+}
+
+void NNUE::refresh(Accumulator *acc, const Bitset64 *pieces_bb, int turn) {
+  const NNUEKernels &kernels = nnue_kernels[simd];
+
+  for (int p = 0; p < 2; p++) {
+    /* A piece on every square and the side to move input at most */
+    if (quantized) {
+      const int16_t *rows[65];
+      int count = position_rows(qweights1[p].data(), p, pieces_bb, turn, rows);
+
+      kernels.accumulate_quantized(qbias1[p].data(), rows, count, nullptr, 0,
+                                   acc->qvalues[p]);
+    } else {
+      const float *rows[65];
+      int count = position_rows(weights1[p].data(), p, pieces_bb, turn, rows);
+
+      kernels.accumulate(bias1[p].data(), rows, count, nullptr, 0,
+                         acc->values[p]);
+    }
+  }
+
+  acc->computed = true;
+}
+
+void NNUE::update(const Accumulator *previous, Accumulator *acc) {
+  const NNUEKernels &kernels = nnue_kernels[simd];
+  int added_count, removed_count;
+
+  for (int p = 0; p < 2; p++) {
+    if (quantized) {
+      const int16_t *added[NNUE_MAX_DIRTY + 1];
+      const int16_t *removed[NNUE_MAX_DIRTY + 1];
+
+      dirty_rows(qweights1[p].data(), p, acc->dirty, added, &added_count,
+                 removed, &removed_count);
+      kernels.accumulate_quantized(previous->qvalues[p], added, added_count,
+                                   removed, removed_count, acc->qvalues[p]);
+    } else {
+      const float *added[NNUE_MAX_DIRTY + 1];
+      const float *removed[NNUE_MAX_DIRTY + 1];
+
+      dirty_rows(weights1[p].data(), p, acc->dirty, added, &added_count,
+                 removed, &removed_count);
+      kernels.accumulate(previous->values[p], added, added_count, removed,
+                         removed_count, acc->values[p]);
+    }
+  }
+
+  acc->computed = true;
+}
+
+float NNUE::evaluate(AccumulatorStack *stack) {
+  int computed = stack->top;
+  while (stack->entries[computed].computed == false) {
+    computed--;
+  }
+
+  for (int i = computed + 1; i <= stack->top; i++) {
+    update(&stack->entries[i - 1], &stack->entries[i]);
+  }
+
+  return evaluate(&stack->entries[stack->top]);
+}
+
+float NNUE::evaluate(const Accumulator *acc) {
+  if (quantized) {
+    return evaluateQuantized(acc);
+  }
+
+  const NNUEKernels &kernels = nnue_kernels[simd];
+
+  float hidden1[NNUE_L1];
+  float hidden2[2 * NNUE_L2];
+  float hidden3[NNUE_L3];
+  float hidden4[NNUE_L4];
+
+  for (int p = 0; p < 2; p++) {
+    for (int j = 0; j < NNUE_L1; j++) {
+      hidden1[j] = crelu2(acc->values[p][j]);
+    }
+
+    kernels.dense(hidden1, NNUE_L1, weights2[p].data(), bias2[p].data(),
+                  NNUE_L2, hidden2 + p * NNUE_L2);
+  }
+
+  for (float &x : hidden2) {
+    x = crelu2(x);
+  }
+
+  kernels.dense(hidden2, 2 * NNUE_L2, weights3.data(), bias3.data(),
+                NNUE_L3, hidden3);
+  for (float &x : hidden3) {
+    x = crelu2(x);
+  }
+
+  kernels.dense(hidden3, NNUE_L3, weights4.data(), bias4.data(), NNUE_L4,
+                hidden4);
+  for (float &x : hidden4) {
+    x = crelu2(x);
+  }
+
+  float logit = bias5;
+  for (int j = 0; j < NNUE_L4; j++) {
+    logit += hidden4[j] * weights5[j];
+  }
+
+  return logit_to_centipawns(logit);
+}
+
+float NNUE::evaluateQuantized(const Accumulator *acc) {
+  const NNUEKernels &kernels = nnue_kernels[simd];
+
+  alignas(64) uint8_t hidden1[NNUE_L1];
+  alignas(64) uint8_t hidden2[2 * NNUE_L2];
+  alignas(64) uint8_t hidden3[NNUE_L3];
+  alignas(64) uint8_t hidden4[NNUE_L4];
+  int32_t output[2 * NNUE_L2];
+
+  for (int p = 0; p < 2; p++) {
+    for (int j = 0; j < NNUE_L1; j++) {
+      hidden1[j] = acc_activation[clamp((int32_t)acc->qvalues[p][j], 0,
+                                        acc_scale)];
+    }
+
+    kernels.dense_quantized(hidden1, NNUE_L1, qweights2[p].data(),
+                            qbias2[p].data(), NNUE_L2, output);
+    for (int j = 0; j < NNUE_L2; j++) {
+      hidden2[p * NNUE_L2 + j] =
+          crelu2_quantized(output[j], (int64_t)NNUE_ACT_ONE << shifts[p]);
+    }
+  }
+
+  kernels.dense_quantized(hidden2, 2 * NNUE_L2, qweights3.data(),
+                          qbias3.data(), NNUE_L3, output);
+  for (int j = 0; j < NNUE_L3; j++) {
+    hidden3[j] =
+        crelu2_quantized(output[j], (int64_t)NNUE_ACT_ONE << shifts[2]);
+  }
+
+  kernels.dense_quantized(hidden3, NNUE_L3, qweights4.data(), qbias4.data(),
+                          NNUE_L4, output);
+  for (int j = 0; j < NNUE_L4; j++) {
+    hidden4[j] =
+        crelu2_quantized(output[j], (int64_t)NNUE_ACT_ONE << shifts[3]);
+  }
+
+  int32_t sum = qbias5;
+  for (int j = 0; j < NNUE_L4; j++) {
+    sum += hidden4[j] * qweights5[j];
+  }
+
+  return logit_to_centipawns((float)sum / ((int64_t)NNUE_ACT_ONE << shifts[4]));
+}
@@ -0,0 +1,301 @@
+#include "../includes/perft.h"
+#include "../includes/fen.h"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+/* Sequence of moves from the root leading to the subtree of a task */
+typedef struct {
+  Move moves[PERFT_SPLIT_DEPTH];
+  int length;
+} PerftTask;
+
+/* Entries of a bucket of the perft cache */
+#define PERFT_BUCKET_SIZE 2
+
+#define PERFT_NODES_MASK 0x00FFFFFFFFFFFFFFULL
+
+PerftCache::PerftCache(size_t mb) {
+  size_t bucket_bytes = PERFT_BUCKET_SIZE * sizeof(PerftEntry);
+
+  /* A power of two, so a key is mapped to its bucket with a mask */
+  bucketCount = bit_floor(max(mb * 1024 * 1024 / bucket_bytes, (size_t)1));
+  entries = new PerftEntry[bucketCount * PERFT_BUCKET_SIZE];
+
+  for (size_t i = 0; i < bucketCount * PERFT_BUCKET_SIZE; i++) {
+    entries[i].key.store(0, memory_order_relaxed);
+    entries[i].data.store(0, memory_order_relaxed);
+  }
+}
+
+PerftCache::~PerftCache() { delete[] entries; }
+
+bool PerftCache::probe(uint64_t key, int depth, uint64_t *nodes) {
+  PerftEntry *bucket = &entries[(key & (bucketCount - 1)) * PERFT_BUCKET_SIZE];
+
+  for (int i = 0; i < PERFT_BUCKET_SIZE; i++) {
+    uint64_t data = bucket[i].data.load(memory_order_relaxed);
+
+    if ((bucket[i].key.load(memory_order_relaxed) ^ data) == key &&
+        (int)(data >> 56) == depth) {
+      *nodes = data & PERFT_NODES_MASK;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void PerftCache::store(uint64_t key, int depth, uint64_t nodes) {
+  PerftEntry *bucket = &entries[(key & (bucketCount - 1)) * PERFT_BUCKET_SIZE];
+  uint64_t data = (nodes & PERFT_NODES_MASK) | ((uint64_t)depth << 56);
+
+  /* The first entry keeps the deepest subtree, the rest go to the second */
+  PerftEntry *entry = &bucket[1];
+  if ((int)(bucket[0].data.load(memory_order_relaxed) >> 56) <= depth) {
+    entry = &bucket[0];
+  }
+
+  entry->key.store(key ^ data, memory_order_relaxed);
+  entry->data.store(data, memory_order_relaxed);
+}
+
+uint64_t perft(Bitboard *bb, int depth, PerftCache *cache) {
+  /* Base case */
+  if (depth == 0) {
+    return 1;
+  }
+
+  uint64_t nodes = 0;
+  bool cached = cache != nullptr && depth >= PERFT_CACHE_MIN_DEPTH;
+
+  if (cached && cache->probe(bb->getHash(), depth, &nodes)) {
+    return nodes;
+  }
+
+  /* General case */
+  MoveList move_list;
+  bb->generateMoves(&move_list);
+
+  /* The moves are legal, so the leaves of the last ply are counted
+   * without making them */
+  if (depth == 1) {
+    return move_list.size();
+  }
+
+  UndoInfo undo;
+  for (Move m : move_list) {
+    bb->makeMove(m, &undo);
+    nodes += perft(bb, depth - 1, cache);
+    bb->unmakeMove(undo);
+  }
+
+  if (cached) {
+    cache->store(bb->getHash(), depth, nodes);
+  }
+
+  return nodes;
+}
+
+/**
+ * Collects the tasks of every move sequence of the given length. Shorter
+ * sequences ending in checkmate or stalemate are leaves of no task
+ *
+ * @param Bitboard * position, restored before returning
+ * @param PerftTask * sequence leading to the position
+ * @param int plies left to split
+ * @param vector<PerftTask> * collected tasks
+ */
+void split_tasks(Bitboard *bb, PerftTask *task, int plies,
+                 vector<PerftTask> *tasks) {
+  if (plies == 0) {
+    tasks->push_back(*task);
+    return;
+  }
+
+  MoveList move_list;
+  bb->generateMoves(&move_list);
+
+  UndoInfo undo;
+  for (Move m : move_list) {
+    task->moves[task->length++] = m;
+    bb->makeMove(m, &undo);
+
+    split_tasks(bb, task, plies - 1, tasks);
+
+    bb->unmakeMove(undo);
+    task->length--;
+  }
+}
+
+uint64_t parallel_perft(const Bitboard &bb, int depth, int threads,
+                        PerftCache *cache) {
+  Bitboard root = bb;
+
+  if (depth <= PERFT_SPLIT_DEPTH || threads <= 1) {
+    return perft(&root, depth, cache);
+  }
+
+  vector<PerftTask> tasks;
+  PerftTask task;
+  task.length = 0;
+  split_tasks(&root, &task, PERFT_SPLIT_DEPTH, &tasks);
+
+  /* Subtrees differ a lot in size, so instead of a fixed share every
+   * thread takes the next pending task when it is done with one */
+  atomic<size_t> next_task(0);
+  atomic<uint64_t> nodes(0);
+
+  auto worker = [&]() {
+    Bitboard board = bb;
+    UndoInfo undo[PERFT_SPLIT_DEPTH];
+    uint64_t worker_nodes = 0;
+
+    for (size_t i = next_task++; i < tasks.size(); i = next_task++) {
+      for (int j = 0; j < tasks[i].length; j++) {
+        board.makeMove(tasks[i].moves[j], &undo[j]);
+      }
+
+      worker_nodes += perft(&board, depth - tasks[i].length, cache);
+
+      for (int j = tasks[i].length - 1; j >= 0; j--) {
+        board.unmakeMove(undo[j]);
+      }
+    }
+
+    nodes += worker_nodes;
+  };
+
+  vector<thread> workers;
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back(worker);
+  }
+
+  for (thread &w : workers) {
+    w.join();
+  }
+
+  return nodes;
+}
+
+uint64_t divide(const Bitboard &bb, int depth, int threads,
+                PerftCache *cache) {
+  Bitboard root = bb;
+  uint64_t nodes = 0;
+
+  MoveList move_list;
+  root.generateMoves(&move_list);
+
+  UndoInfo undo;
+  for (Move m : move_list) {
+    root.makeMove(m, &undo);
+    uint64_t move_nodes = parallel_perft(root, depth - 1, threads, cache);
+    root.unmakeMove(undo);
+
+    cout << m.formatToUci() << ": " << move_nodes << endl;
+    nodes += move_nodes;
+  }
+
+  return nodes;
+}
+
+/**
+ * Milliseconds elapsed since a point in time
+ *
+ * @param chrono::steady_clock::time_point start
+ * @return elapsed time in ms, at least 1 so it can divide
+ */
+int64_t ms_since(chrono::steady_clock::time_point start) {
+  auto elapsed = chrono::steady_clock::now() - start;
+  int64_t ms = chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+
+  return max(ms, (int64_t)1);
+}
+
+int run_perft_suite(LookupTable *lut, const string &path, int max_depth,
+                    int threads, PerftCache *cache) {
+  ifstream epd(path);
+
+  if (epd.is_open() == false) {
+    cout << "cannot open " << path << endl;
+    return -1;
+  }
+
+  int positions = 0;
+  int failed = 0;
+  uint64_t total_nodes = 0;
+  auto suite_start = chrono::steady_clock::now();
+
+  string line;
+  while (getline(epd, line)) {
+    size_t fields_pos = line.find(';');
+
+    if (line.empty() || line[0] == '#' || fields_pos == line.npos) {
+      continue;
+    }
+
+    string fen = line.substr(0, fields_pos);
+    fen.erase(fen.find_last_not_of(" \t") + 1);
+
+    Bitboard bb = parse_fen(lut, fen);
+    bool passed = true;
+    uint64_t position_nodes = 0;
+    auto position_start = chrono::steady_clock::now();
+
+    cout << "position " << ++positions << ": " << fen << endl;
+
+    /* Every field is "D<depth> <expected nodes>" */
+    istringstream fields(line.substr(fields_pos));
+    string field;
+
+    while (getline(fields, field, ';')) {
+      istringstream parser(field);
+      char d;
+      int depth;
+      uint64_t expected;
+
+      if (!(parser >> d >> depth >> expected) || d != 'D' ||
+          (max_depth > 0 && depth > max_depth)) {
+        continue;
+      }
+
+      auto start = chrono::steady_clock::now();
+      uint64_t nodes = parallel_perft(bb, depth, threads, cache);
+      int64_t ms = ms_since(start);
+
+      cout << "  depth " << depth << ": " << nodes;
+      if (nodes == expected) {
+        cout << " ok";
+      } else {
+        cout << " FAILED, expected " << expected;
+        passed = false;
+      }
+      cout << " (" << ms << " ms, " << nodes * 1000 / ms << " nodes/sec)"
+           << endl;
+
+      position_nodes += nodes;
+    }
+
+    int64_t ms = ms_since(position_start);
+
+    cout << "  " << (passed ? "passed" : "FAILED") << ", " << position_nodes
+         << " nodes, " << ms << " ms, " << position_nodes * 1000 / ms
+         << " nodes/sec" << endl;
+
+    total_nodes += position_nodes;
+    failed += (passed == false);
+  }
+
+  int64_t ms = ms_since(suite_start);
+
+  cout << "suite: " << positions - failed << "/" << positions
+       << " positions passed, " << total_nodes << " nodes, " << ms << " ms, "
+       << total_nodes * 1000 / ms << " nodes/sec" << endl;
+
+  return failed;
+}
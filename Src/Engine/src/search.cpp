@@ -0,0 +1,758 @@
+#include "../includes/search.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <syncstream>
+
+/* Depth skipping of the helper threads, helper i skips the depths where
+ * (depth + skip_phase[i]) / skip_size[i] is odd */
+#define SKIP_TABLE_SIZE 20
+
+const int skip_size[SKIP_TABLE_SIZE] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                        3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+const int skip_phase[SKIP_TABLE_SIZE] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3,
+                                         4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+
+/* The accumulators of a thread hold a whole branch of the search */
+static_assert(ACCUMULATOR_STACK_SIZE > MAX_DEPTH);
+
+/* Mate scores are stored in the transposition table relative to the node
+ * instead of the root, so they stay valid when reached at another height */
+int score_to_tt(int score, int height) {
+  if (score > MATE_BOUND) {
+    return score + height;
+  } else if (score < -MATE_BOUND) {
+    return score - height;
+  }
+
+  return score;
+}
+
+int score_from_tt(int score, int height) {
+  if (score > MATE_BOUND) {
+    return score - height;
+  } else if (score < -MATE_BOUND) {
+    return score + height;
+  }
+
+  return score;
+}
+
+SearchLimits init_search_limits() {
+  SearchLimits limits;
+
+  limits.time[WHITE] = limits.time[BLACK] = -1;
+  limits.inc[WHITE] = limits.inc[BLACK] = 0;
+  limits.movesToGo = 0;
+  limits.moveTime = -1;
+  limits.depth = 0;
+  limits.nodes = 0;
+  limits.infinite = false;
+  limits.ponder = false;
+
+  return limits;
+}
+
+void init_time_management(SearchInfo *info, Color side) {
+  const SearchLimits &limits = info->limits;
+
+  info->softLimit = -1;
+  info->hardLimit = -1;
+
+  if (limits.infinite) {
+    return;
+  }
+
+  /* A fixed time per move is used whole */
+  if (limits.moveTime >= 0) {
+    info->softLimit = max(limits.moveTime - MOVE_OVERHEAD, 1);
+    info->hardLimit = info->softLimit;
+    return;
+  }
+
+  if (limits.time[side] < 0) {
+    return;
+  }
+
+  int64_t time_left = max(limits.time[side] - MOVE_OVERHEAD, 1);
+  int64_t moves_to_go = DEFAULT_MOVES_TO_GO;
+
+  if (limits.movesToGo > 0) {
+    moves_to_go = min(limits.movesToGo, DEFAULT_MOVES_TO_GO);
+  }
+
+  /* The soft limit is an even share of the clock plus most of the
+   * increment, and an iteration may run up to four times over it */
+  int64_t soft_limit = time_left / moves_to_go + limits.inc[side] * 3 / 4;
+
+  info->hardLimit = min(soft_limit * 4, time_left);
+  info->softLimit = min(soft_limit, info->hardLimit);
+}
+
+int64_t elapsed_ms(const SearchInfo *info) {
+  auto elapsed = chrono::steady_clock::now() - info->start;
+  return chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+}
+
+/**
+ * Signals the search to stop when the hard time limit or the nodes limit
+ * is reached, and stops it when signaled
+ *
+ * @param SearchInfo * running search
+ */
+void check_limits(SearchInfo *info) {
+  SearchSignals *signals = info->signals;
+
+  /* The time limits only apply once the ponder move is played */
+  if (signals->ponder.load(memory_order_relaxed) == false &&
+      info->hardLimit >= 0 && elapsed_ms(info) >= info->hardLimit) {
+    signals->stop = true;
+  }
+
+  if (info->limits.nodes > 0 &&
+      signals->nodes.load(memory_order_relaxed) >= info->limits.nodes) {
+    signals->stop = true;
+  }
+
+  if (signals->stop.load(memory_order_relaxed)) {
+    info->stopped = true;
+  }
+}
+
+/**
+ * Scores the moves for move ordering: the transposition table move first,
+ * then captures and queen promotions by MVV-LVA, then killers and then the
+ * rest of the quiet moves by history
+ *
+ * @param Bitboard * position of the moves
+ * @param MoveList * moves to be scored
+ * @param Move transposition table move
+ * @param const SearchInfo * state of the search thread
+ * @param int distance to the root
+ */
+void score_moves(Bitboard *bb, MoveList *moves, Move tt_move,
+                 const SearchInfo *info, int height) {
+  for (int i = 0; i < moves->size(); i++) {
+    Move move = (*moves)[i];
+    int flag = move.getFlag();
+    int &score = moves->score(i);
+
+    if (move == tt_move) {
+      score = TT_MOVE_SCORE;
+    } else if (flag == CAPTURE || flag >= KNIGHT_PROMOTION_CAPTURE) {
+      int victim = bb->pieceAtSquare(move.getTargetSquare()) / 2;
+      score = CAPTURE_SCORE + victim * 8 - move.getPiece();
+    } else if (flag == EP_CAPTURE) {
+      score = CAPTURE_SCORE + PAWN * 8 - PAWN;
+    } else if (flag == QUEEN_PROMOTION) {
+      score = CAPTURE_SCORE + QUEEN * 8;
+    } else if (move == info->killers[height][0]) {
+      score = KILLER_SCORE;
+    } else if (move == info->killers[height][1]) {
+      score = KILLER_SCORE - 1;
+    } else {
+      score = info->history[move.getColor()][move.getSourceSquare()]
+                           [move.getTargetSquare()];
+    }
+  }
+}
+
+/**
+ * Updates the killers and the history with a quiet move causing a cutoff
+ *
+ * @param SearchInfo * state of the search thread
+ * @param Move move causing the cutoff
+ * @param int remaining depth
+ * @param int distance to the root
+ */
+void update_quiet_stats(SearchInfo *info, Move move, int ply, int height) {
+  int flag = move.getFlag();
+
+  if (flag == CAPTURE || flag == EP_CAPTURE || flag >= KNIGHT_PROMOTION) {
+    return;
+  }
+
+  if (info->killers[height][0] != move) {
+    info->killers[height][1] = info->killers[height][0];
+    info->killers[height][0] = move;
+  }
+
+  int &history = info->history[move.getColor()][move.getSourceSquare()]
+                              [move.getTargetSquare()];
+  history += ply * ply;
+
+  /* Age the whole table so it stays below the killers */
+  if (history >= MAX_HISTORY) {
+    for (auto &side : info->history) {
+      for (auto &from : side) {
+        for (int &to : from) {
+          to /= 2;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Counts a searched node. The nodes are added to the shared count in
+ * blocks, checking the limits. The first iteration of the main thread
+ * always completes, so there is a move to play
+ *
+ * @param SearchInfo * state of the search thread
+ */
+void count_node(SearchInfo *info) {
+  if ((++info->nodes & (CHECK_NODES - 1)) == 0) {
+    info->signals->nodes.fetch_add(CHECK_NODES, memory_order_relaxed);
+
+    if (info->threadId > 0 || info->rootDepth > 1) {
+      check_limits(info);
+    }
+  }
+}
+
+/**
+ * Converts an evaluation of the network into a search score, below the
+ * mate scores
+ *
+ * @param float evaluation in centipawns
+ * @return search score
+ */
+int eval_to_score(float eval) {
+  return clamp((int)lround(eval), -MATE_BOUND + 1, MATE_BOUND - 1);
+}
+
+/**
+ * Looks up the score of a position in the evaluation cache, counting the
+ * probe
+ *
+ * @param EvalCache & shared cache of the evaluations
+ * @param uint64_t Zobrist key of the position
+ * @param int * where the score is written if found
+ * @param SearchInfo * state of the search thread
+ * @return whether the position was found
+ */
+bool probe_eval_cache(EvalCache &cache, uint64_t key, int *score,
+                      SearchInfo *info) {
+  info->cacheProbes++;
+
+  if (cache.probe(key, score)) {
+    info->cacheHits++;
+    return true;
+  }
+
+  return false;
+}
+
+/**
+ * Evaluates a leaf, looking it up in the evaluation cache before running
+ * the network
+ *
+ * @param Bitboard * position to evaluate
+ * @param ChessNN & network evaluating the leaf
+ * @param EvalCache & shared cache of the evaluations
+ * @param SearchInfo * state of the search thread
+ * @return score of the position
+ */
+int evaluate_leaf(Bitboard *bb, ChessNN &nn, EvalCache &cache,
+                  SearchInfo *info) {
+  uint64_t key = bb->getHash();
+  int score;
+
+  if (probe_eval_cache(cache, key, &score, info)) {
+    return score;
+  }
+
+  score = eval_to_score(nn.evaluate(bb, info->threadId));
+  cache.store(key, score);
+
+  return score;
+}
+
+/**
+ * Evaluates the children of a frontier node together, so the network runs
+ * once for every batch of them instead of once for every child. The
+ * children found in the evaluation cache are left out of the batches. The
+ * moves are sorted in the order the search visits them
+ *
+ * @param Bitboard * position of the moves, restored before returning
+ * @param MoveList * scored moves of the position
+ * @param ChessNN & network evaluating the children
+ * @param EvalCache & shared cache of the evaluations
+ * @param SearchInfo * state of the search thread
+ * @param int * where the scores of the children are written
+ */
+void evaluate_children(Bitboard *bb, MoveList *moves, ChessNN &nn,
+                       EvalCache &cache, SearchInfo *info, int *scores) {
+  FrontierBuffer *frontier = info->frontier;
+  auto pieces_bb = frontier->piecesBB;
+  int *turns = frontier->turns;
+  float *evals = frontier->evals;
+  int *missing = frontier->missing;
+  uint64_t *keys = frontier->keys;
+  int count = 0;
+
+  for (int i = 0; i < moves->size(); i++) {
+    count_node(info);
+
+    UndoInfo undo;
+    bb->makeMove(moves->pickMove(i), &undo);
+
+    if (probe_eval_cache(cache, bb->getHash(), &scores[i], info) == false) {
+      copy(bb->getPieces(), bb->getPieces() + 12, pieces_bb[count]);
+      turns[count] = bb->getTurn();
+      keys[count] = bb->getHash();
+      missing[count++] = i;
+    }
+
+    bb->unmakeMove(undo);
+  }
+
+  if (info->stopped || count == 0) {
+    return;
+  }
+
+  nn.predict_batch(pieces_bb, turns, count, evals, info->threadId);
+
+  for (int i = 0; i < count; i++) {
+    scores[missing[i]] = eval_to_score(evals[i]);
+    cache.store(keys[i], scores[missing[i]]);
+  }
+}
+
+pair<int, Move> alphabeta(Bitboard *bb, int ply, int height, int a, int b,
+                          ChessNN &nn, TranspositionTable &tt,
+                          EvalCache &cache, SearchInfo *info) {
+  count_node(info);
+
+  if (info->stopped) {
+    return {0, Move()};
+  }
+
+  if (ply == 0) {
+    return {evaluate_leaf(bb, nn, cache, info), Move()};
+  }
+
+  int original_a = a;
+  int original_b = b;
+  uint64_t key = bb->getHash();
+  Move tt_move = Move();
+  TTData tt_data;
+
+  if (tt.probe(key, &tt_data)) {
+    int tt_score = score_from_tt(tt_data.score, height);
+    tt_move = tt_data.move;
+
+    /* The root always searches so it has a move to play */
+    if (height > 0 && tt_data.depth >= ply &&
+        (tt_data.bound == BOUND_EXACT ||
+         (tt_data.bound == BOUND_LOWER && tt_score >= b) ||
+         (tt_data.bound == BOUND_UPPER && tt_score <= a))) {
+      return {tt_score, tt_move};
+    }
+  }
+
+  MoveList moves;
+  bb->generateMoves(&moves);
+
+  /* Checkmate or stalemate */
+  if (moves.empty()) {
+    if (bb->isCheck(bb->getTurn()) == false) {
+      return {0, Move()};
+    }
+
+    int mate = MATE_SCORE - height;
+    return {(bb->getTurn() == WHITE) ? -mate : mate, Move()};
+  }
+
+  score_moves(bb, &moves, tt_move, info, height);
+
+  /* Frontier nodes evaluate all their children in batches, the cutoffs
+   * below then only save the comparisons. The native evaluator is cheaper
+   * one leaf at a time */
+  int *child_scores = info->frontier->scores;
+  bool batched = ply == 1 && nn.getBatchSize() > 1 && !nn.isNative();
+
+  if (batched) {
+    evaluate_children(bb, &moves, nn, cache, info, child_scores);
+
+    if (info->stopped) {
+      return {0, Move()};
+    }
+  }
+
+  auto search_child = [&](int i, Move move) {
+    if (batched) {
+      return child_scores[i];
+    }
+
+    UndoInfo undo;
+    bb->makeMove(move, &undo);
+    auto [child_value, _] =
+        alphabeta(bb, ply - 1, height + 1, a, b, nn, tt, cache, info);
+    bb->unmakeMove(undo);
+
+    return child_value;
+  };
+
+  Move best_move = Move();
+  int value;
+
+  if (bb->getTurn() == WHITE) {
+    value = -INF_SCORE;
+
+    for (int i = 0; i < moves.size(); i++) {
+      Move move = moves.pickMove(i);
+      int child_value = search_child(i, move);
+
+      if (info->stopped) {
+        return {0, Move()};
+      }
+
+      if (child_value > value) {
+        value = child_value;
+        best_move = move;
+      }
+
+      if (value >= b) {
+        update_quiet_stats(info, best_move, ply, height);
+        break;
+      }
+
+      a = max(a, value);
+    }
+  } else {
+    value = INF_SCORE;
+
+    for (int i = 0; i < moves.size(); i++) {
+      Move move = moves.pickMove(i);
+      int child_value = search_child(i, move);
+
+      if (info->stopped) {
+        return {0, Move()};
+      }
+
+      if (child_value < value) {
+        value = child_value;
+        best_move = move;
+      }
+
+      if (value <= a) {
+        update_quiet_stats(info, best_move, ply, height);
+        break;
+      }
+
+      b = min(b, value);
+    }
+  }
+
+  /* Scores are from the white point of view, so the bound only depends on
+   * where the value falls with respect to the original window */
+  int bound = BOUND_EXACT;
+  if (value <= original_a) {
+    bound = BOUND_UPPER;
+  } else if (value >= original_b) {
+    bound = BOUND_LOWER;
+  }
+
+  tt.store(key, best_move, score_to_tt(value, height), ply, bound);
+
+  return {value, best_move};
+}
+
+int principal_variation(Bitboard *bb, Move best_move, int depth,
+                        TranspositionTable &tt, Move *pv) {
+  UndoInfo undo[MAX_DEPTH];
+  int length = 1;
+
+  pv[0] = best_move;
+  bb->makeMove(best_move, &undo[0]);
+
+  TTData tt_data;
+  while (length < depth && tt.probe(bb->getHash(), &tt_data)) {
+    MoveList moves;
+    bb->generateMoves(&moves);
+
+    if (find(moves.begin(), moves.end(), tt_data.move) == moves.end()) {
+      break;
+    }
+
+    bb->makeMove(tt_data.move, &undo[length]);
+    pv[length++] = tt_data.move;
+  }
+
+  for (int i = length - 1; i >= 0; i--) {
+    bb->unmakeMove(undo[i]);
+  }
+
+  return length;
+}
+
+/**
+ * Prints the UCI info line of the last completed iteration of a thread
+ *
+ * @param Bitboard * root position
+ * @param const SearchInfo * state of the search thread
+ * @param TranspositionTable & transposition table of the search
+ */
+void print_info(Bitboard *bb, const SearchInfo *info,
+                TranspositionTable &tt) {
+  int64_t time = elapsed_ms(info);
+  uint64_t nodes = info->signals->nodes.load(memory_order_relaxed) +
+                   (info->nodes & (CHECK_NODES - 1));
+  uint64_t nps = nodes * 1000 / max(time, (int64_t)1);
+
+  /* UCI scores are from the point of view of the side to move */
+  int score = info->bestScore;
+  if (bb->getTurn() == BLACK) {
+    score = -score;
+  }
+
+  /* The line is emitted at once so it does not mix with the output of the
+   * UCI thread */
+  osyncstream out(cout);
+
+  out << "info depth " << info->completedDepth << " score ";
+
+  if (abs(score) > MATE_BOUND) {
+    int mate_plies = MATE_SCORE - abs(score);
+    out << "mate " << ((score > 0) ? 1 : -1) * (mate_plies + 1) / 2;
+  } else {
+    out << "cp " << score;
+  }
+
+  out << " nodes " << nodes << " nps " << nps << " time " << time
+      << " hashfull " << tt.hashfull() << " pv";
+
+  Move pv[MAX_DEPTH];
+  int length = principal_variation(bb, info->bestMove, info->completedDepth,
+                                   tt, pv);
+
+  for (int i = 0; i < length; i++) {
+    out << " " << pv[i].formatToUci();
+  }
+
+  out << endl;
+}
+
+void iterative_deepening(Bitboard *bb, SearchInfo *info, ChessNN &nn,
+                         TranspositionTable &tt, EvalCache &cache) {
+  int max_depth = MAX_DEPTH;
+  if (info->limits.depth > 0) {
+    max_depth = min(info->limits.depth, MAX_DEPTH);
+  }
+
+  for (int depth = 1; depth <= max_depth; depth++) {
+    if (info->threadId > 0) {
+      int i = (info->threadId - 1) % SKIP_TABLE_SIZE;
+
+      if (((depth + skip_phase[i]) / skip_size[i]) % 2 != 0) {
+        continue;
+      }
+    }
+
+    info->rootDepth = depth;
+
+    auto [score, move] =
+        alphabeta(bb, depth, 0, -INF_SCORE, INF_SCORE, nn, tt, cache, info);
+
+    /* An aborted iteration is discarded */
+    if (info->stopped) {
+      break;
+    }
+
+    /* Checkmate or stalemate at the root */
+    if (move == Move()) {
+      break;
+    }
+
+    info->completedDepth = depth;
+    info->bestScore = score;
+    info->bestMove = move;
+
+    if (info->threadId > 0) {
+      continue;
+    }
+
+    print_info(bb, info, tt);
+
+    /* Do not start an iteration that is not expected to finish */
+    if (info->signals->ponder == false && info->softLimit >= 0 &&
+        elapsed_ms(info) >= info->softLimit) {
+      break;
+    }
+  }
+}
+
+Move search(Bitboard *bb, const SearchLimits &limits, ChessNN &nn,
+            TranspositionTable &tt, EvalCache &cache, SearchSignals *signals,
+            int threads) {
+  auto start = chrono::steady_clock::now();
+
+  signals->nodes = 0;
+  signals->cacheProbes = 0;
+  signals->cacheHits = 0;
+  tt.newSearch();
+
+  /* Every thread searches its own copy of the position */
+  vector<SearchInfo> infos(threads);
+  vector<Bitboard> boards(threads, *bb);
+  vector<FrontierBuffer> frontiers(threads);
+
+  for (int i = 0; i < threads; i++) {
+    SearchInfo &info = infos[i];
+
+    info.limits = limits;
+    info.signals = signals;
+    info.start = start;
+    info.nodes = 0;
+    info.threadId = i;
+    info.rootDepth = 0;
+    info.stopped = false;
+    info.cacheProbes = 0;
+    info.cacheHits = 0;
+    info.completedDepth = 0;
+    info.bestScore = 0;
+    info.bestMove = Move();
+    info.frontier = &frontiers[i];
+
+    for (auto &killers : info.killers) {
+      killers[0] = killers[1] = Move();
+    }
+
+    for (auto &side : info.history) {
+      for (auto &from : side) {
+        for (int &to : from) {
+          to = 0;
+        }
+      }
+    }
+
+    init_time_management(&info, bb->getTurn());
+  }
+
+  /* Every thread evaluates with its own network buffers and accumulators */
+  nn.setThreads(threads);
+
+  for (int i = 0; i < threads; i++) {
+    nn.attach(&boards[i], i);
+  }
+
+  vector<thread> helpers;
+  for (int i = 1; i < threads; i++) {
+    helpers.emplace_back(iterative_deepening, &boards[i], &infos[i], ref(nn),
+                         ref(tt), ref(cache));
+  }
+
+  iterative_deepening(&boards[0], &infos[0], nn, tt, cache);
+
+  /* The helpers stop with the main thread */
+  signals->stop = true;
+
+  for (thread &helper : helpers) {
+    helper.join();
+  }
+
+  /* The deepest completed iteration wins, the main thread on a tie */
+  SearchInfo *best = &infos[0];
+
+  for (int i = 1; i < threads; i++) {
+    if (infos[i].completedDepth > best->completedDepth) {
+      best = &infos[i];
+    }
+  }
+
+  if (best != &infos[0]) {
+    print_info(bb, best, tt);
+  }
+
+  /* The nodes not flushed yet make the count exact for the caller */
+  for (SearchInfo &info : infos) {
+    signals->nodes += info.nodes & (CHECK_NODES - 1);
+    signals->cacheProbes += info.cacheProbes;
+    signals->cacheHits += info.cacheHits;
+  }
+
+  /* Hit rate in permille, as hashfull */
+  uint64_t probes = signals->cacheProbes;
+  uint64_t hits = signals->cacheHits;
+
+  osyncstream(cout) << "info string evalcache probes " << probes << " hits "
+                    << hits << " hitrate "
+                    << hits * 1000 / max(probes, (uint64_t)1) << endl;
+
+  return best->bestMove;
+}
+
+SearchThread::SearchThread() {
+  signals.stop = false;
+  signals.ponder = false;
+  signals.nodes = 0;
+  signals.cacheProbes = 0;
+  signals.cacheHits = 0;
+  finished = false;
+  released = false;
+}
+
+SearchThread::~SearchThread() { stop(); }
+
+void SearchThread::start(const Bitboard &bb, const SearchLimits &limits,
+                         ChessNN &nn, TranspositionTable &tt,
+                         EvalCache &cache, int threads) {
+  stop();
+
+  signals.stop = false;
+  signals.ponder = limits.ponder;
+  finished = false;
+  released = false;
+
+  worker = thread([this, board = bb, limits, &nn, &tt, &cache,
+                   threads]() mutable {
+    Move best_move = search(&board, limits, nn, tt, cache, &signals, threads);
+
+    /* UCI forbids sending the bestmove of an infinite or ponder search
+     * before the GUI asks for it */
+    finished = true;
+    if (limits.infinite || signals.ponder) {
+      released.wait(false);
+    }
+
+    /* The second move of the variation is the one to ponder on */
+    Move pv[2];
+    int length = 0;
+
+    if (best_move != Move()) {
+      length = principal_variation(&board, best_move, 2, tt, pv);
+    }
+
+    osyncstream out(cout);
+
+    out << "bestmove " << ((length > 0) ? pv[0].formatToUci() : "0000");
+    if (length > 1) {
+      out << " ponder " << pv[1].formatToUci();
+    }
+
+    out << endl;
+  });
+}
+
+void SearchThread::stop() {
+  signals.stop = true;
+  released = true;
+  released.notify_all();
+
+  if (worker.joinable()) {
+    worker.join();
+  }
+}
+
+void SearchThread::ponderhit() {
+  signals.ponder = false;
+
+  /* A search that is already over only waits for the ponderhit */
+  if (finished) {
+    released = true;
+    released.notify_all();
+  }
+}
@@ -0,0 +1,143 @@
+#include "../includes/transposition_table.h"
+#include <algorithm>
+
+/* Number of buckets sampled by hashfull, 1000 entries */
+#define HASHFULL_SAMPLE (1000 / TT_BUCKET_SIZE)
+
+/* The age is stored in 6 bits */
+#define AGE_MASK 0x3F
+
+/* Plies a non exact score may be shallower than the stored one of the same
+ * position and search and still replace it */
+#define TT_REPLACE_MARGIN 3
+
+/* Packing of the entry data */
+
+static uint64_t pack_data(Move move, int score, int depth, int bound,
+                          unsigned int age) {
+  return (uint64_t)move.getData() | ((uint64_t)(uint16_t)score << 32) |
+         ((uint64_t)(depth & 0xFF) << 48) | ((uint64_t)(bound & 0x3) << 56) |
+         ((uint64_t)(age & AGE_MASK) << 58);
+}
+
+static int data_bound(uint64_t data) { return (data >> 56) & 0x3; }
+
+static int data_depth(uint64_t data) { return (data >> 48) & 0xFF; }
+
+static unsigned int data_age(uint64_t data) { return data >> 58; }
+
+TranspositionTable::TranspositionTable(size_t mb)
+    : buckets(nullptr), bucketCount(0), age(0) {
+  resize(mb);
+}
+
+TranspositionTable::~TranspositionTable() { delete[] buckets; }
+
+void TranspositionTable::resize(size_t mb) {
+  /* Allocate before releasing so a failure leaves the current table */
+  size_t count = mb * 1024 * 1024 / sizeof(TTBucket);
+  TTBucket *resized = new TTBucket[count];
+
+  delete[] buckets;
+  buckets = resized;
+  bucketCount = count;
+
+  clear();
+}
+
+void TranspositionTable::clear() {
+  for (size_t i = 0; i < bucketCount; i++) {
+    for (TTEntry &entry : buckets[i].entries) {
+      entry.key.store(0, memory_order_relaxed);
+      entry.data.store(0, memory_order_relaxed);
+    }
+  }
+
+  age = 0;
+}
+
+void TranspositionTable::newSearch() { age = (age + 1) & AGE_MASK; }
+
+bool TranspositionTable::probe(uint64_t key, TTData *tt_data) {
+  for (TTEntry &entry : bucket(key).entries) {
+    uint64_t data = entry.data.load(memory_order_relaxed);
+
+    if ((entry.key.load(memory_order_relaxed) ^ data) != key ||
+        data_bound(data) == BOUND_NONE) {
+      continue;
+    }
+
+    tt_data->move = Move((uint32_t)data);
+    tt_data->score = (int16_t)(data >> 32);
+    tt_data->depth = data_depth(data);
+    tt_data->bound = data_bound(data);
+
+    return true;
+  }
+
+  return false;
+}
+
+void TranspositionTable::store(uint64_t key, Move move, int score, int depth,
+                               int bound) {
+  TTEntry *entries = bucket(key).entries;
+  TTEntry *replace = &entries[0];
+  int replace_value = INT32_MAX;
+
+  for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+    uint64_t data = entries[i].data.load(memory_order_relaxed);
+
+    if (data_bound(data) == BOUND_NONE) {
+      replace = &entries[i];
+      break;
+    }
+
+    /* Same position */
+    if ((entries[i].key.load(memory_order_relaxed) ^ data) == key) {
+      /* A much deeper bound of this search, maybe found by another thread,
+       * is worth more than a shallow one */
+      if (bound != BOUND_EXACT && data_age(data) == age &&
+          depth < data_depth(data) - TT_REPLACE_MARGIN) {
+        return;
+      }
+
+      /* Keep the best move of the position if none was found */
+      if (move == Move()) {
+        move = Move((uint32_t)data);
+      }
+
+      replace = &entries[i];
+      break;
+    }
+
+    /* Otherwise replace the shallowest entry, aging the older searches */
+    int value = data_depth(data) - 8 * ((age - data_age(data)) & AGE_MASK);
+
+    if (value < replace_value) {
+      replace_value = value;
+      replace = &entries[i];
+    }
+  }
+
+  uint64_t data = pack_data(move, score, depth, bound, age);
+
+  replace->key.store(key ^ data, memory_order_relaxed);
+  replace->data.store(data, memory_order_relaxed);
+}
+
+int TranspositionTable::hashfull() {
+  int count = 0;
+  size_t sample = min((size_t)HASHFULL_SAMPLE, bucketCount);
+
+  for (size_t i = 0; i < sample; i++) {
+    for (TTEntry &entry : buckets[i].entries) {
+      uint64_t data = entry.data.load(memory_order_relaxed);
+
+      if (data_bound(data) != BOUND_NONE && data_age(data) == age) {
+        count++;
+      }
+    }
+  }
+
+  return count * 1000 / (sample * TT_BUCKET_SIZE);
+}